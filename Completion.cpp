@@ -21,11 +21,20 @@
 */
 
 #include "Completion.h"
+#include "CompletionIndex.h"
+#include "ParenMatching.h"
 #include "PREDICATE.h"
 #include "SwiPrologEngine.h"
 #include <QDebug>
 #include <QFile>
 #include <QTextStream>
+#include <QCache>
+#include <QHash>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QWaitCondition>
 
 struct Bin : C { Bin(CCP op, T Left, T Right) : C(op, V(Left, Right)) {} };
 struct Uni : C { Uni(CCP op, T arg) : C(op, arg) {} };
@@ -40,37 +49,50 @@ struct arith : Bin { arith(T Pred, T Num) : Bin("/", Pred, Num) {} };
 #define one long(1)
 #define _V T()
 
+/** text left and right of cursor, in the current input line
+ */
+bool Completion::context(int promptPosition, QTextCursor c, QString &before, QString &after) {
+    int p = c.position();
+    if (p < promptPosition)
+        return false;
+
+    c.setPosition(promptPosition, c.KeepAnchor);
+    before = c.selectedText();
+
+    c.setPosition(p);
+    c.movePosition(c.EndOfLine, c.KeepAnchor);
+    after = c.selectedText();
+
+    return !before.isEmpty();
+}
+
 /** context sensitive completion
  *  take current line, give list of completions (both atoms and files)
  *  thanks to Jan for crafting a proper interface wrapping SWI-Prolog available facilities
  */
 QString Completion::initialize(int promptPosition, QTextCursor c, QStringList &strings) {
+    QString before, after;
+    if (context(promptPosition, c, before, after))
+        return complete_input(before, after, strings);
+    return QString();
+}
+
+/** call prolog:complete_input/4 in current thread
+ */
+QString Completion::complete_input(QString before, QString after, QStringList &strings) {
 
-    //SwiPrologEngine::in_thread _int;
     QString rets;
 
     try {
-        int p = c.position();
-        Q_ASSERT(p >= promptPosition);
-
-        c.setPosition(promptPosition, c.KeepAnchor);
-        QString left = c.selectedText();
-        if (left.length()) {
-            PlString Before(left.toStdWString().data());
-
-            c.setPosition(p);
-            c.movePosition(c.EndOfLine, c.KeepAnchor);
-            QString after = c.selectedText();
-            PlString After(after.toStdWString().data());
-
-            PlTerm Completions, Delete, word;
-            if (PlCall("prolog", "complete_input", PlTermv(Before, After, Delete, Completions)))
-                for (PlTail l(Completions); l.next(word); )
-                    strings.append(t2w(word));
-
-            c.setPosition(p);
-            rets = t2w(Delete);
-        }
+        PlString Before(WCS(before));
+        PlString After(WCS(after));
+
+        PlTerm Completions, Delete, word;
+        if (PlCall("prolog", "complete_input", PlTermv(Before, After, Delete, Completions)))
+            for (PlTail l(Completions); l.next(word); )
+                strings.append(t2w(word));
+
+        rets = t2w(Delete);
     }
     catch(PlException e) {
         qDebug() << t2w(e);
@@ -82,6 +104,153 @@ QString Completion::initialize(int promptPosition, QTextCursor c, QStringList &s
     return rets;
 }
 
+/** a request waiting to be served, the latest of its owner
+ */
+struct completion_request {
+    const QObject *owner;
+    int generation;
+    QString before, after;
+    Completion::t_completed done;
+};
+static QMutex request_sync;
+static QWaitCondition request_cond;
+static QList<completion_request> requests;      // syncronized ! oldest first
+static QHash<const QObject*, int> current;      // syncronized ! owner -> generation of its latest request
+static int last_generation;                     // syncronized ! each request gets a new one
+static bool stopping;                           // syncronized !
+
+/** results of older requests, or cancelled, of same owner are dropped
+ */
+static bool is_current(const completion_request &r) {
+    QMutexLocker lk(&request_sync);
+    return current.value(r.owner) == r.generation;
+}
+
+/** remove owner's request still waiting - request_sync held
+ */
+static void unqueue(const QObject *owner) {
+    for (int i = 0; i < requests.size(); ++i)
+        if (requests[i].owner == owner) {
+            requests.removeAt(i);
+            break;
+        }
+}
+
+/** serve completion requests on a private engine, so the console engine can be busy
+ */
+class completion_worker : public QThread {
+protected:
+    virtual void run() {
+        SwiPrologEngine::in_thread _e;
+        for ( ; ; ) {
+            completion_request r;
+            {   QMutexLocker lk(&request_sync);
+                while (requests.isEmpty() && !stopping)
+                    request_cond.wait(&request_sync);
+                if (stopping)
+                    return;
+                r = requests.takeFirst();
+            }
+
+            QStringList strings;
+            QString prefix = Completion::complete_input(r.before, r.after, strings);
+
+            GuiTaskQueue::post([=]() {
+                if (is_current(r))
+                    r.done(prefix, strings);
+            });
+        }
+    }
+};
+static completion_worker *worker;
+
+/** let the worker release its engine and exit
+ */
+static void stop_worker() {
+    {   QMutexLocker lk(&request_sync);
+        stopping = true;
+        requests.clear();
+        current.clear();
+        request_cond.wakeOne();
+    }
+    worker->wait(1000);
+}
+
+/** replace owner's request still waiting
+ */
+void Completion::request(const QObject *owner, QString before, QString after, t_completed done) {
+    if (!worker) {
+        (worker = new completion_worker)->start();
+        SwiPrologEngine::on_halt(stop_worker);
+    }
+
+    QMutexLocker lk(&request_sync);
+    unqueue(owner);
+    completion_request r;
+    r.owner = owner;
+    r.generation = ++last_generation;
+    r.before = before;
+    r.after = after;
+    r.done = done;
+    current[owner] = r.generation;
+    requests.append(r);
+    request_cond.wakeOne();
+}
+
+/** no results will be delivered to owner: safe to call on its destruction
+ */
+void Completion::cancel(const QObject *owner) {
+    QMutexLocker lk(&request_sync);
+    unqueue(owner);
+    current.remove(owner);
+}
+
+/** text typed after last results only extends the prefix: filter them
+ */
+bool Completion::results::filter(QString before, QString &prefix, QStringList &strings) const {
+    if (this->before.isEmpty() || !before.startsWith(this->before))
+        return false;
+
+    QString typed = before.mid(this->before.length());
+    foreach (QChar c, typed)
+        if (!c.isLetterOrNumber() && c != '_')
+            return false;
+
+    prefix = this->prefix + typed;
+    foreach (auto s, this->strings)
+        if (s.startsWith(prefix))
+            strings.append(s);
+    return true;
+}
+
+/** scan back from cursor to start of identifier
+ *  quoted text and comments are told by the block's cached tokens, as highlighted
+ */
+bool Completion::word_prefix(int promptPosition, QTextCursor c, QString &prefix) {
+    if (c.position() <= promptPosition)
+        return false;
+
+    QTextBlock b = c.block();
+    QString text = b.text();
+    int at = c.positionInBlock(), from = qMax(0, promptPosition - b.position());
+
+    int s = at;
+    while (s > from && (text[s - 1].isLetterOrNumber() || text[s - 1] == '_'))
+        --s;
+    if (s == at || !(text[s].isLetter() || text[s] == '_'))
+        return false;
+    if (s > from && QString("'\"`/\\.~").contains(text[s - 1]))
+        return false;
+
+    // not within quoted text or comments
+    const BlockInfo::token *t = BlockInfo::of(b)->token_at(s);
+    if (!t || (t->type != BlockInfo::t_atom && t->type != BlockInfo::t_variable))
+        return false;
+
+    prefix = text.mid(s, at - s);
+    return true;
+}
+
 /** issue a query filling the model storage
  *  this will change when I will learn how to call SWI-Prolog completion interface
  */
@@ -95,7 +264,7 @@ void Completion::initialize(QStringList &strings) {
                 quv(m,
                     quv(a,
                         join(PlCompound("current_predicate", mod(m, arith(p, a))),
-                            neg(C("sub_atom", PlTermv(p, zero, one, _V, A("$"))))
+                            neg(C("sub_atom", PlTermv(p, zero, one, _V, FA("$"))))
                 ))),
             l));
         if (q.next_solution())
@@ -109,67 +278,299 @@ void Completion::initialize(QStringList &strings) {
 
 Completion::status Completion::helpidx_status = Completion::untried;
 Completion::t_pred_docs Completion::pred_docs;
+int Completion::pred_docs_version;
 
-/** initialize and cache all predicates with description
+/** word -> formatted tip, GUI thread only: cleared when pred_docs change
  */
-bool Completion::helpidx() {
-    if (helpidx_status == untried) {
-        helpidx_status = missing;
+static QCache<QString, QString> tip_cache(256);
+
+/** pred_docs cache file layout: native endianness, it's per user
+ *  header, key (padded to 4), names sorted, declarations, UTF-16 string pool
+ */
+struct cache_header {
+    char magic[4];
+    quint32 format;
+    quint32 key_len;
+    quint32 count;
+    quint32 ndecls;
+    quint32 pool_len;   // in UTF-16 units
+};
+struct cache_name {
+    quint32 off, len;       // in pool
+    quint32 first, ndecls;  // in declarations
+};
+struct cache_decl {
+    qint32 arity;
+    quint32 off, len;       // description in pool
+};
+static const char cache_magic[4] = { 'P', 'Q', 'H', 'I' };
+enum { cache_format = 1 };
+
+static QString cache_path() {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (dir.isEmpty() || !QDir().mkpath(dir))
+        return QString();
+    return dir + "/helpidx.cache";
+}
+
+/** the mapped cache, and what was read from it: strings point into mapping
+ *  written in GUI thread before the loader starts, then only read
+ */
+static QFile *cache_file;
+static QByteArray cached_key;
+static Completion::t_pred_docs cached_docs;
+
+/** SWI-Prolog version and checksum of library(helpidx): empty if not found
+ */
+static QByteArray helpidx_key() {
+    PlTerm Path;
+    if (!PlCall("absolute_file_name", V(C("library(helpidx)"), Path,
+                C("[file_type(prolog), access(read), file_errors(fail)]"))))
+        return QByteArray();
+
+    QFile f(t2w(Path));
+    if (!f.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    QCryptographicHash h(QCryptographicHash::Md5);
+    h.addData(f.readAll());
+    return QByteArray::number(qlonglong(PL_query(PL_QUERY_VERSION))) + " " + h.result().toHex();
+}
+
+static void append_pool(QVector<ushort> &pool, const QString &s, quint32 &off, quint32 &len) {
+    off = pool.size();
+    len = s.length();
+    const ushort *u = s.utf16();
+    for (int i = 0; i < s.length(); ++i)
+        pool.append(u[i]);
+}
+
+/** save in binary format, replacing atomically
+ *  while the current file is mapped (it can't be replaced on Windows) write beside it:
+ *  the next load_cache moves it in place, before mapping
+ */
+static void write_cache(const QByteArray &key, const Completion::t_pred_docs &docs) {
+    QString path = cache_path();
+    if (path.isEmpty())
+        return;
+    if (cache_file)
+        path += ".new";
+
+    QVector<cache_name> names;
+    QVector<cache_decl> decls;
+    QVector<ushort> pool;
+    for (auto d = docs.constBegin(); d != docs.constEnd(); ++d) {
+        cache_name n;
+        append_pool(pool, d.key(), n.off, n.len);
+        n.first = decls.size();
+        n.ndecls = d.value().size();
+        names.append(n);
+        foreach (const Completion::t_decl &x, d.value()) {
+            cache_decl c;
+            c.arity = x.first;
+            append_pool(pool, x.second, c.off, c.len);
+            decls.append(c);
+        }
+    }
+
+    cache_header h;
+    memcpy(h.magic, cache_magic, 4);
+    h.format = cache_format;
+    h.key_len = key.size();
+    h.count = names.size();
+    h.ndecls = decls.size();
+    h.pool_len = pool.size();
+
+    QByteArray k = key;
+    while (k.size() % 4)
+        k.append('\0');
+
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly))
+        return;
+    f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    f.write(k);
+    f.write(reinterpret_cast<const char*>(names.constData()), names.size() * sizeof(cache_name));
+    f.write(reinterpret_cast<const char*>(decls.constData()), decls.size() * sizeof(cache_decl));
+    f.write(reinterpret_cast<const char*>(pool.constData()), pool.size() * sizeof(ushort));
+    if (!f.commit())
+        qDebug() << "write_cache failed" << path;
+}
+
+/** map the cache, and build pred_docs on it, without copying text
+ */
+bool Completion::load_cache() {
+    QString path = cache_path();
+    if (path.isEmpty())
+        return false;
+
+    // written by previous run, while this one was mapped
+    if (QFile::exists(path + ".new")) {
+        QFile::remove(path);
+        QFile::rename(path + ".new", path);
+    }
+
+    QFile *f = new QFile(path);
+    const uchar *m = 0;
+    qint64 size = 0;
+    if (f->open(QIODevice::ReadOnly)) {
+        size = f->size();
+        if (size >= qint64(sizeof(cache_header)))
+            m = f->map(0, size);
+    }
+    if (!m) {
+        delete f;
+        return false;
+    }
+
+    const cache_header *h = reinterpret_cast<const cache_header*>(m);
+    qint64 key_size = (h->key_len + 3) & ~3u;
+    const qint64 names_at = sizeof(cache_header) + key_size;
+    const qint64 decls_at = names_at + qint64(h->count) * sizeof(cache_name);
+    const qint64 pool_at = decls_at + qint64(h->ndecls) * sizeof(cache_decl);
+    if (    memcmp(h->magic, cache_magic, 4) || h->format != cache_format ||
+            pool_at + qint64(h->pool_len) * sizeof(ushort) != size) {
+        qDebug() << "load_cache: invalid" << path;
+        delete f;
+        return false;
+    }
+
+    const cache_name *names = reinterpret_cast<const cache_name*>(m + names_at);
+    const cache_decl *decls = reinterpret_cast<const cache_decl*>(m + decls_at);
+    const QChar *pool = reinterpret_cast<const QChar*>(m + pool_at);
+
+    t_pred_docs docs;
+    for (quint32 i = 0; i < h->count; ++i) {
+        const cache_name &n = names[i];
+        if (qint64(n.off) + n.len > h->pool_len || qint64(n.first) + n.ndecls > h->ndecls) {
+            delete f;
+            return false;
+        }
+        t_decls l;
+        for (quint32 d = n.first; d < n.first + n.ndecls; ++d) {
+            if (qint64(decls[d].off) + decls[d].len > h->pool_len) {
+                delete f;
+                return false;
+            }
+            l.append(qMakePair(int(decls[d].arity), QString::fromRawData(pool + decls[d].off, decls[d].len)));
+        }
+        docs.insert(QString::fromRawData(pool + n.off, n.len), l);
+    }
+
+    // keep mapped for process lifetime
+    cache_file = f;
+    cached_key = QByteArray(reinterpret_cast<const char*>(m + sizeof(cache_header)), h->key_len);
+    cached_docs = docs;
+
+    pred_docs = docs;
+    helpidx_status = available;
+    tip_cache.clear();
+    ++pred_docs_version;
+    startup_timeline::mark("helpidx cache mapped");
+    return true;
+}
+
+/** background loader of helpidx and console_input
+ *  pred_docs and helpidx_status are only touched in GUI thread
+ */
+class helpidx_loader : public QThread {
+protected:
+    virtual void run() {
+        Completion::t_pred_docs docs;
+        Completion::status status = Completion::missing;
+
         SwiPrologEngine::in_thread _e;
         try {
-            if (    PlCall("load_files(library(helpidx), [silent(true)])") &&
-                    PlCall("current_module(help_index)"))
+            QByteArray key = helpidx_key();
+            if (!key.isEmpty() && key == cached_key) {
+                // already published by load_cache
+                docs = cached_docs;
+                if (    PlCall("load_files(library(console_input), [silent(true)])") &&
+                        PlCall("current_module(prolog_console_input)"))
+                    status = Completion::available;
+            }
+            else if (   PlCall("load_files(library(helpidx), [silent(true)])") &&
+                        PlCall("current_module(help_index)"))
             {
                 {   PlTerm Name, Arity, Descr, Start, Stop;
                     PlQuery q("help_index", "predicate", V(Name, Arity, Descr, Start, Stop));
                     while (q.next_solution()) {
                         long arity = Arity.type() == PL_INTEGER ? long(Arity) : -1;
                         QString name = t2w(Name);
-                        t_pred_docs::iterator x = pred_docs.find(name);
-                        if (x == pred_docs.end())
-                            x = pred_docs.insert(name, t_decls());
+                        Completion::t_pred_docs::iterator x = docs.find(name);
+                        if (x == docs.end())
+                            x = docs.insert(name, Completion::t_decls());
                         x.value().append(qMakePair(int(arity), t2w(Descr)));
                     }
                 }
 
                 if (PlCall("load_files(library(console_input), [silent(true)])"))
                     if (PlCall("current_module(prolog_console_input)"))
-                        helpidx_status = available;
-            }
+                        status = Completion::available;
 
-            /*
-            if (!PlCall("current_module(prolog_console_input)")) {
-                QString ci = "console_input.pl";
-                QFile f(QString(":/%1").arg(ci));
-                if (f.open(f.ReadOnly)) {
-                    QTextStream s(&f);
-                    if (!_e.named_load(ci, s.readAll()))
-                        qDebug() << "can't load" << ci;
-                }
+                if (!key.isEmpty() && !docs.isEmpty())
+                    write_cache(key, docs);
             }
-            */
         }
         catch(PlException e) {
             qDebug() << CCP(e);
         }
+
+        CompletionIndex::build(docs);
+
+        helpidx_loader *self = this;
+        GuiTaskQueue::post([=]() {
+            Completion::pred_docs = docs;
+            Completion::helpidx_status = status;
+            tip_cache.clear();
+            ++Completion::pred_docs_version;
+            if (status == Completion::available)
+                startup_timeline::mark("helpidx loaded");
+            startup_timeline::mark("completion index built");
+            self->wait();
+            delete self;
+        });
     }
+};
+
+/** start the loader only once
+ */
+void Completion::warm_up() {
+    static QAtomicInt started;
+    if (started.testAndSetOrdered(0, 1))
+        (new helpidx_loader)->start();
+}
 
+/** initialize if required, return true if available
+ */
+bool Completion::helpidx() {
+    if (helpidx_status == untried)
+        warm_up();
     return helpidx_status == available && !pred_docs.isEmpty();
 }
 
 /** access/compute predicate description tip from cached
  */
 QString Completion::pred_tip(QTextCursor c) {
-    if (helpidx_status == available) {
-        c.select(c.WordUnderCursor);
-        QString w =  c.selectedText();
-        auto p = pred_docs.constFind(w);
-        if (p != pred_docs.end()) {
-            QStringList l;
-            foreach(auto x, p.value())
-                l.append(QString("%1/%2:%3").arg(w).arg(x.first).arg(x.second));
-            return l.join("\n");
-        }
+    c.select(c.WordUnderCursor);
+    return pred_tip(c.selectedText());
+}
+
+QString Completion::pred_tip(QString w) {
+    if (helpidx_status != available || w.isEmpty())
+        return "";
+
+    if (QString *t = tip_cache.object(w))
+        return *t;
+
+    QString tip;
+    auto p = pred_docs.constFind(w);
+    if (p != pred_docs.end()) {
+        QStringList l;
+        foreach(auto x, p.value())
+            l.append(QString("%1/%2:%3").arg(w).arg(x.first).arg(x.second));
+        tip = l.join("\n");
     }
-    return "";
+    tip_cache.insert(w, new QString(tip));
+    return tip;
 }
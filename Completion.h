@@ -29,6 +29,7 @@
 #include <QCompleter>
 #include <QTextCursor>
 #include <QAbstractItemView>
+#include <functional>
 
 /** service class, holds a sorted list of predicates for word completion
  */
@@ -37,6 +38,39 @@ struct PQCONSOLESHARED_EXPORT Completion
     /** context sensitive completion */
     static QString initialize(int promptPosition, QTextCursor cursor, QStringList &strings);
 
+    /** text left and right of cursor, false if nothing to complete */
+    static bool context(int promptPosition, QTextCursor cursor, QString &before, QString &after);
+
+    /** run prolog:complete_input in current thread, return the prefix to replace */
+    static QString complete_input(QString before, QString after, QStringList &strings);
+
+    /** completion results, delivered in GUI thread */
+    typedef std::function<void(QString prefix, QStringList strings)> t_completed;
+
+    /** queue completion to a background engine: only the latest request of owner is served,
+     *  done runs in GUI thread if no other request or cancel of owner came in the meantime
+     */
+    static void request(const QObject *owner, QString before, QString after, t_completed done);
+
+    /** drop results of owner's pending request */
+    static void cancel(const QObject *owner);
+
+    /** latest results of a console, kept until its next prompt */
+    struct results {
+        QString before, prefix;
+        QStringList strings;
+
+        void clear() { before.clear(); prefix.clear(); strings.clear(); }
+
+        /** filter, while text typed since only extends their prefix */
+        bool filter(QString before, QString &prefix, QStringList &strings) const;
+    };
+
+    /** identifier (atom or variable) left of cursor, completed locally without calling Prolog
+     *  false when context requires complete_input (quoted text, file names)
+     */
+    static bool word_prefix(int promptPosition, QTextCursor cursor, QString &prefix);
+
     /** load predicates into strings */
     static void initialize(QStringList &strings);
 
@@ -50,11 +84,25 @@ struct PQCONSOLESHARED_EXPORT Completion
     typedef QMap<QString, t_decls> t_pred_docs;
     static t_pred_docs pred_docs;
 
-    /** initialize if required, return true if available */
+    /** incremented when pred_docs is replaced: tips computed before are stale */
+    static int pred_docs_version;
+
+    /** map pred_docs saved by a previous run, without running Prolog - call from GUI thread
+     *  the background loader checks it against SWI-Prolog version and helpidx.pl checksum
+     */
+    static bool load_cache();
+
+    /** start loading if required, return true if available - never blocks */
     static bool helpidx();
 
+    /** load helpidx and console_input on a background engine, and build
+     *  CompletionIndex, then publish pred_docs and helpidx_status in GUI thread
+     */
+    static void warm_up();
+
     /** access/compute predicate description tip from cached */
     static QString pred_tip(QTextCursor c);
+    static QString pred_tip(QString word);
 };
 
 #endif // COMPLETION_H
@@ -0,0 +1,564 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define PROLOG_MODULE "pqConsole"
+#include "PREDICATE.h"
+#include "CompletionIndex.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QDebug>
+#include <QSharedPointer>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FUZZY_SSE2
+#include <emmintrin.h>
+#endif
+
+/** index storage, guarded by index_sync
+ */
+static QMutex index_sync;
+static CompletionIndex::t_entries sorted;   // syncronized !
+static CompletionIndex::t_entries pending;  // syncronized ! unsorted additions
+static QAtomicInt built;
+static int version;                         // syncronized ! changed by each merge
+
+static bool by_word(const CompletionIndex::entry &a, const CompletionIndex::entry &b) {
+    return a.word < b.word;
+}
+
+/** fold pending into sorted, joining duplicates - index_sync held
+ */
+static void merge_pending() {
+    if (pending.isEmpty())
+        return;
+
+    std::sort(pending.begin(), pending.end(), by_word);
+
+    CompletionIndex::t_entries merged;
+    merged.reserve(sorted.size() + pending.size());
+
+    auto a = sorted.constBegin(), ae = sorted.constEnd();
+    auto b = pending.constBegin(), be = pending.constEnd();
+    while (a != ae || b != be) {
+        const CompletionIndex::entry &e = (b == be || (a != ae && !(b->word < a->word))) ? *a++ : *b++;
+        if (!merged.isEmpty() && merged.last().word == e.word) {
+            merged.last().kinds |= e.kinds;
+            merged.last().ndocs = qMax(merged.last().ndocs, e.ndocs);
+        }
+        else
+            merged.append(e);
+    }
+
+    sorted = merged;
+    pending.clear();
+    ++version;
+}
+
+void CompletionIndex::add(const t_entries &batch) {
+    QMutexLocker lk(&index_sync);
+    pending += batch;
+}
+
+bool CompletionIndex::is_built() {
+    return built.load() != 0;
+}
+
+CompletionIndex::t_entries CompletionIndex::range(const QString &prefix, int &lo, int &hi) {
+    QMutexLocker lk(&index_sync);
+    merge_pending();
+
+    auto b = sorted.constBegin(), e = sorted.constEnd();
+    auto l = std::lower_bound(b, e, entry(prefix, 0), by_word);
+    auto h = std::partition_point(l, e, [&](const entry &x) { return x.word.startsWith(prefix); });
+    lo = int(l - b);
+    hi = int(h - b);
+    return sorted;
+}
+
+/** words laid out for a sequential scan
+ *  a mask each word, with a bit each character class, tells which words
+ *  can contain the pattern: the (vectorized) prefilter tests 4 masks at once,
+ *  then scoring searches pattern characters in case folded words, 8 at once
+ */
+struct packed_table {
+    int version;
+    CompletionIndex::t_entries entries;
+    QVector<quint32> masks;
+    QVector<int> offsets;   // start of word N in chars, N+1 is its end
+    QVector<ushort> chars;
+    QVector<ushort> folded; // chars, case folded
+};
+static QSharedPointer<const packed_table> packed;   // syncronized !
+
+/** case folding of words and pattern: same on both sides, Unicode aware
+ */
+static inline ushort fold(ushort c) {
+    if (c < 128)
+        return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    return QChar(c).toLower().unicode();
+}
+
+/** bit 0..25 letters, 26 digits, 27 underscore, 28 others - of a folded character
+ */
+static inline quint32 char_class(ushort c) {
+    if (c >= 'a' && c <= 'z')
+        return 1u << (c - 'a');
+    if (c >= '0' && c <= '9')
+        return 1u << 26;
+    return c == '_' ? 1u << 27 : 1u << 28;
+}
+
+static quint32 char_mask(const ushort *w, int n) {
+    quint32 m = 0;
+    for (int i = 0; i < n; ++i)
+        m |= char_class(w[i]);
+    return m;
+}
+
+static packed_table *pack(const CompletionIndex::t_entries &entries, int version) {
+    packed_table *t = new packed_table;
+    t->version = version;
+    t->entries = entries;
+    t->masks.reserve(entries.size());
+    t->offsets.reserve(entries.size() + 1);
+    foreach (const CompletionIndex::entry &e, entries) {
+        int from = t->chars.size(), n = e.word.length();
+        t->offsets.append(from);
+        const ushort *w = e.word.utf16();
+        for (int i = 0; i < n; ++i) {
+            t->chars.append(w[i]);
+            t->folded.append(fold(w[i]));
+        }
+        t->masks.append(char_mask(t->folded.constData() + from, n));
+    }
+    t->offsets.append(t->chars.size());
+    return t;
+}
+
+/** indices of words whose mask includes q
+ */
+static void prefilter(const quint32 *masks, int n, quint32 q, QVector<int> &hits) {
+    int i = 0;
+#ifdef FUZZY_SSE2
+    __m128i vq = _mm_set1_epi32(int(q));
+    for ( ; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i));
+        int hit = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(v, vq), vq)));
+        if (hit)
+            for (int b = 0; b < 4; ++b)
+                if (hit & (1 << b))
+                    hits.append(i + b);
+    }
+#endif
+    for ( ; i < n; ++i)
+        if ((masks[i] & q) == q)
+            hits.append(i);
+}
+
+/** position of first c in f[i, n), n if none
+ */
+static inline int next_match(const ushort *f, int i, int n, ushort c) {
+#ifdef FUZZY_SSE2
+    __m128i vc = _mm_set1_epi16(short(c));
+    for ( ; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(f + i));
+        int hit = _mm_movemask_epi8(_mm_cmpeq_epi16(v, vc));
+        if (hit)
+            for (int b = 0; ; ++b)
+                if (hit & (1 << (2 * b)))
+                    return i + b;
+    }
+#endif
+    for ( ; i < n; ++i)
+        if (f[i] == c)
+            break;
+    return i;
+}
+
+/** greedy subsequence match of p (folded pf) in w (folded f): false if not a subsequence
+ *  matches score more at word start, after '_' or a lower/upper change,
+ *  when consecutive, or of same case: gaps and longer words score less, even below 0
+ */
+static bool fuzzy_score(const ushort *w, const ushort *f, int n, const ushort *p, const ushort *pf, int m, int &score) {
+    if (n < m)
+        return false;
+    int s = 0, last = -1;
+    for (int i = 0, j = 0; j < m; ++i, ++j) {
+        i = next_match(f, i, n, pf[j]);
+        if (i == n)
+            return false;
+        int bonus = 1;
+        if (i == 0)
+            bonus += 8;
+        else {
+            QChar b(w[i - 1]), c(w[i]);
+            if (b == '_' || (b.isLower() && c.isUpper()) || (!b.isDigit() && c.isDigit()))
+                bonus += 6;
+        }
+        if (last >= 0 && last == i - 1)
+            bonus += 4;
+        else if (last >= 0)
+            s -= qMin(i - last - 1, 3);
+        if (w[i] == p[j])
+            bonus += 1;
+        s += bonus;
+        last = i;
+    }
+    score = s * 16 - n;
+    return true;
+}
+
+/** recently accepted completions, GUI thread only
+ */
+static QHash<QString, int> recent;
+static int recent_tick;
+
+void CompletionIndex::used(const QString &word) {
+    recent[word] = ++recent_tick;
+    if (recent.size() > 1000) // forget the oldest half
+        for (auto r = recent.begin(); r != recent.end(); )
+            if (r.value() < recent_tick - 500)
+                r = recent.erase(r);
+            else
+                ++r;
+}
+
+CompletionIndex::t_entries CompletionIndex::fuzzy(const QString &pattern, int k) {
+    QSharedPointer<const packed_table> t;
+    {   QMutexLocker lk(&index_sync);
+        merge_pending();
+        if (!packed || packed->version != version)
+            packed = QSharedPointer<const packed_table>(pack(sorted, version));
+        t = packed;
+    }
+
+    const ushort *p = pattern.utf16();
+    int m = pattern.length();
+    QVector<ushort> folded(m);
+    for (int j = 0; j < m; ++j)
+        folded[j] = fold(p[j]);
+    const ushort *pf = folded.constData();
+
+    QVector<int> hits;
+    prefilter(t->masks.constData(), t->masks.size(), char_mask(pf, m), hits);
+
+    // keep best k in a min heap of (score, -index): ties go to alphabetical order
+    typedef QPair<int, int> t_scored;
+    std::vector<t_scored> best;
+    best.reserve(k + 1);
+    foreach (int h, hits) {
+        int from = t->offsets[h], n = t->offsets[h + 1] - from, s;
+        if (!fuzzy_score(t->chars.constData() + from, t->folded.constData() + from, n, p, pf, m, s))
+            continue;
+        if (!recent.isEmpty()) {
+            auto r = recent.constFind(t->entries[h].word);
+            if (r != recent.constEnd())
+                s += 16 * qMax(0, 32 - (recent_tick - r.value()));
+        }
+        t_scored x(s, -h);
+        if (int(best.size()) < k) {
+            best.push_back(x);
+            std::push_heap(best.begin(), best.end(), std::greater<t_scored>());
+        }
+        else if (best.front() < x) {
+            std::pop_heap(best.begin(), best.end(), std::greater<t_scored>());
+            best.back() = x;
+            std::push_heap(best.begin(), best.end(), std::greater<t_scored>());
+        }
+    }
+
+    std::sort_heap(best.begin(), best.end(), std::greater<t_scored>());
+    t_entries result;
+    result.reserve(int(best.size()));
+    for (auto b = best.begin(); b != best.end(); ++b)
+        result.append(t->entries[-b->second]);
+    return result;
+}
+
+bool CompletionIndex::is_identifier(const QString &w) {
+    if (w.isEmpty() || w.length() > 80 || !w[0].isLower())
+        return false;
+    for (int i = 1; i < w.length(); ++i)
+        if (!w[i].isLetterOrNumber() && w[i] != '_')
+            return false;
+    return true;
+}
+
+/** scan modules, predicates and atoms currently defined, add documented names
+ */
+void CompletionIndex::build(const Completion::t_pred_docs &docs) {
+    t_entries batch;
+
+    try {
+        PlTerm M, N, A, X;
+        {   PlQuery q("current_module", V(M));
+            while (q.next_solution())
+                batch.append(entry(t2w(M), module));
+        }
+        {   PlQuery q("current_predicate", V(C(":", V(M, C("/", V(N, A))))));
+            while (q.next_solution()) {
+                QString n = t2w(N);
+                if (!n.startsWith('$'))
+                    batch.append(entry(n, predicate));
+            }
+        }
+        {   PlQuery q("current_atom", V(X));
+            while (q.next_solution())
+                if (X.type() == PL_ATOM) {
+                    QString a = t2w(X);
+                    if (is_identifier(a))
+                        batch.append(entry(a, atom));
+                }
+        }
+
+        // keep up to date after each file loaded
+        PlCall("assertz((user:message_hook(load_file(done(_,_,_,M,_,_)), _, _) :- "
+               "catch(pqConsole:completion_loaded(M), _, true), fail))");
+    }
+    catch(PlException e) {
+        qDebug() << CCP(e);
+    }
+
+    for (auto d = docs.constBegin(); d != docs.constEnd(); ++d)
+        batch.append(entry(d.key(), documented, d.value().count()));
+
+    add(batch);
+    built.store(1);
+}
+
+/** completion_loaded(+Module)
+ *  add Module and its predicates to completion index: called after a file is loaded
+ */
+PREDICATE(completion_loaded, 1) {
+    CompletionIndex::t_entries batch;
+    batch.append(CompletionIndex::entry(t2w(PL_A1), CompletionIndex::module));
+
+    PlTerm N, H;
+    PlQuery q("current_predicate", V(N, C(":", V(PL_A1, H))));
+    while (q.next_solution()) {
+        QString n = t2w(N);
+        if (!n.startsWith('$'))
+            batch.append(CompletionIndex::entry(n, CompletionIndex::predicate));
+    }
+
+    CompletionIndex::add(batch);
+    return TRUE;
+}
+
+CompletionModel::CompletionModel(QObject *parent)
+    : QAbstractListModel(parent), lo(0), hi(0), sorted_(false), with_docs_(false), rows(0)
+{
+}
+
+bool CompletionModel::filter(const QString &prefix, bool with_docs) {
+    if (!CompletionIndex::is_built())
+        return false;
+
+    int l, h;
+    CompletionIndex::t_entries e = CompletionIndex::range(prefix, l, h);
+    if (l == h)
+        return false;
+
+    beginResetModel();
+    entries = e;
+    lo = l;
+    hi = h;
+    sorted_ = true;
+    prefix_ = prefix;
+    with_docs_ = with_docs;
+    local.clear();
+    count_rows();
+    endResetModel();
+    return true;
+}
+
+bool CompletionModel::rank(const QString &pattern, bool with_docs) {
+    if (!CompletionIndex::is_built())
+        return false;
+
+    CompletionIndex::t_entries e = CompletionIndex::fuzzy(pattern, max_ranked);
+    if (e.isEmpty())
+        return false;
+
+    beginResetModel();
+    entries = e;
+    lo = 0;
+    hi = e.size();
+    sorted_ = false;
+    prefix_ = pattern;
+    with_docs_ = with_docs;
+    local.clear();
+    count_rows();
+    endResetModel();
+    return true;
+}
+
+void CompletionModel::assign(const QStringList &strings, const QString &prefix, bool with_docs) {
+    beginResetModel();
+    entries.clear();
+    foreach (auto s, strings) {
+        auto p = Completion::pred_docs.constFind(s);
+        entries.append(CompletionIndex::entry(s, 0, p == Completion::pred_docs.constEnd() ? 0 : p.value().count()));
+    }
+    lo = 0;
+    hi = entries.size();
+    sorted_ = false;
+    prefix_ = prefix;
+    with_docs_ = with_docs;
+    local.clear();
+    count_rows();
+    endResetModel();
+}
+
+/** entries in filter() range are sorted, others are few
+ */
+void CompletionModel::set_local(const QStringList &tokens) {
+    beginResetModel();
+    local.clear();
+    foreach (auto t, tokens) {
+        bool shown = false;
+        if (sorted_)
+            shown = std::binary_search(entries.constBegin() + lo, entries.constBegin() + hi,
+                                       CompletionIndex::entry(t, 0), by_word);
+        else
+            for (int e = lo; e < hi && !shown; ++e)
+                shown = entries[e].word == t;
+        if (!shown)
+            local.append(t);
+    }
+    count_rows();
+    endResetModel();
+}
+
+/** plain: a row each entry - with docs: a row each declaration
+ */
+void CompletionModel::count_rows() {
+    first_row.clear();
+    if (!with_docs_) {
+        rows = local.size() + hi - lo;
+        return;
+    }
+    first_row.reserve(hi - lo);
+    rows = local.size();
+    for (int e = lo; e < hi; ++e) {
+        first_row.append(rows);
+        rows += qMax(1, entries[e].ndocs);
+    }
+}
+
+int CompletionModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : rows;
+}
+
+/** EditRole is the text to insert, DisplayRole adds the description
+ */
+QVariant CompletionModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || (role != Qt::DisplayRole && role != Qt::EditRole))
+        return QVariant();
+
+    int row = index.row();
+    if (row < local.size())
+        return local[row];
+    if (!with_docs_)
+        return entries[lo + row - local.size()].word;
+
+    int e = int(std::upper_bound(first_row.constBegin(), first_row.constEnd(), row) - first_row.constBegin()) - 1;
+    const CompletionIndex::entry &x = entries[lo + e];
+    int d = row - first_row[e];
+
+    auto p = Completion::pred_docs.constFind(x.word);
+    if (p == Completion::pred_docs.constEnd() || d >= p.value().count())
+        return x.word;
+
+    const Completion::t_decl &decl = p.value()[d];
+    QStringList la;
+    for (int n = 0; n < decl.first; ++n)
+        la.append(QString(QChar('A' + n)));
+    QString head = la.isEmpty() ? x.word : QString("%1(%2)").arg(x.word).arg(la.join(", "));
+    if (role == Qt::EditRole)
+        return head;
+    return QString("%1 | %2").arg(head).arg(decl.second);
+}
+
+CompletionTokens::CompletionTokens(int budget)
+    : budget(budget)
+{
+}
+
+template<class F> void CompletionTokens::tokens(const QString &text, F f) {
+    const QChar *t = text.constData();
+    int n = text.length();
+    for (int i = 0; i < n; ) {
+        if (!t[i].isLetter() && t[i] != '_') {
+            ++i;
+            continue;
+        }
+        int s = i;
+        while (i < n && (t[i].isLetterOrNumber() || t[i] == '_'))
+            ++i;
+        if (i - s >= 3 && (s == 0 || !t[s - 1].isDigit()))
+            f(QString(t + s, i - s));
+    }
+}
+
+/** only the tail of large outputs is worth scanning
+ */
+void CompletionTokens::add_text(const QString &text) {
+    QString tail = text.length() > 65536 ? text.right(65536) : text;
+    tokens(tail, [this](const QString &w) {
+        auto c = counts.find(w);
+        if (c == counts.end())
+            c = counts.insert(w, 0);
+        ++c.value();
+        order.enqueue(c.key());
+        if (order.size() > budget) {
+            auto o = counts.find(order.dequeue());
+            if (--o.value() == 0)
+                counts.erase(o);
+        }
+    });
+}
+
+QStringList CompletionTokens::complete(const QString &prefix, int max, const QString &text) const {
+    QHash<QString, int> found;
+    tokens(text, [&](const QString &w) {
+        if (w.length() > prefix.length() && w.startsWith(prefix))
+            found[w] += 1;
+    });
+    for (auto c = counts.constBegin(); c != counts.constEnd(); ++c)
+        if (c.key().length() > prefix.length() && c.key().startsWith(prefix))
+            found[c.key()] += c.value();
+
+    QList< QPair<int, QString> > l;
+    for (auto f = found.constBegin(); f != found.constEnd(); ++f)
+        l.append(qMakePair(-f.value(), f.key()));
+    std::sort(l.begin(), l.end());
+
+    QStringList r;
+    for (int i = 0; i < l.size() && i < max; ++i)
+        r.append(l[i].second);
+    return r;
+}
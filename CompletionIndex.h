@@ -0,0 +1,150 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef COMPLETIONINDEX_H
+#define COMPLETIONINDEX_H
+
+#include "pqConsole_global.h"
+#include "Completion.h"
+
+#include <QVector>
+#include <QHash>
+#include <QQueue>
+#include <QStringList>
+#include <QAbstractListModel>
+
+/** sorted array of completion candidates: predicates, modules, atoms, documented names
+ *  built once on a background engine, then updated from load_file messages
+ *  lookup by prefix is a binary search: additions are buffered, and merged by next lookup
+ *  fuzzy lookup scans a packed copy, rebuilt after changes
+ */
+struct PQCONSOLESHARED_EXPORT CompletionIndex {
+
+    enum kind { predicate = 1, module = 2, atom = 4, documented = 8 };
+
+    struct entry {
+        entry() : kinds(0), ndocs(0) {}
+        entry(const QString &word, int kinds, int ndocs = 0) : word(word), kinds(kinds), ndocs(ndocs) {}
+        QString word;
+        int kinds;  // kind flags
+        int ndocs;  // count of declarations in Completion::pred_docs
+    };
+    typedef QVector<entry> t_entries;
+
+    /** queue candidates, from any thread */
+    static void add(const t_entries &batch);
+
+    /** true after first build completed */
+    static bool is_built();
+
+    /** entries [lo, hi) start with prefix: returned array is shared, not copied */
+    static t_entries range(const QString &prefix, int &lo, int &hi);
+
+    /** subsequence match, ranked by word boundaries, case and recent use: best k entries
+     *  call from GUI thread
+     */
+    static t_entries fuzzy(const QString &pattern, int k);
+
+    /** account a completion accepted by user, to rank it higher next time - GUI thread */
+    static void used(const QString &word);
+
+    /** scan the running system, and install the load hook - in a Prolog thread */
+    static void build(const Completion::t_pred_docs &docs);
+
+    /** candidate word syntax: an unquoted atom */
+    static bool is_identifier(const QString &word);
+};
+
+/** popup model: a view of the index range, or of a list from complete_input
+ *  with_docs: a row for each documented declaration, formatted only when displayed
+ */
+class PQCONSOLESHARED_EXPORT CompletionModel : public QAbstractListModel {
+    Q_OBJECT
+public:
+
+    explicit CompletionModel(QObject *parent = 0);
+
+    /** show index entries starting with prefix, false if none */
+    bool filter(const QString &prefix, bool with_docs);
+
+    /** show best fuzzy matches of pattern, false if none */
+    bool rank(const QString &pattern, bool with_docs);
+
+    /** show completions computed elsewhere */
+    void assign(const QStringList &strings, const QString &prefix, bool with_docs);
+
+    /** add tokens from console buffer on top, skipping those already shown */
+    void set_local(const QStringList &tokens);
+
+    /** text being completed */
+    QString prefix() const { return prefix_; }
+    bool with_docs() const { return with_docs_; }
+
+    virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    virtual QVariant data(const QModelIndex &index, int role) const;
+
+    /** popup size of fuzzy matches */
+    enum { max_ranked = 64 };
+
+private:
+
+    CompletionIndex::t_entries entries;
+    int lo, hi;
+    bool sorted_;   // entries [lo, hi) is an index range
+    QString prefix_;
+    bool with_docs_;
+
+    /** with_docs: row of first declaration of each entry */
+    QVector<int> first_row;
+    int rows;
+
+    /** rows before entries */
+    QStringList local;
+
+    void count_rows();
+};
+
+/** identifiers seen in a console: submitted input and recent output
+ *  counted incrementally, the oldest forgotten beyond a tokens budget
+ */
+class PQCONSOLESHARED_EXPORT CompletionTokens {
+public:
+
+    explicit CompletionTokens(int budget = 8000);
+
+    /** count identifiers in text */
+    void add_text(const QString &text);
+
+    /** tokens starting with prefix - most frequent first - also from text (the current input) */
+    QStringList complete(const QString &prefix, int max, const QString &text = QString()) const;
+
+private:
+
+    int budget;
+    QHash<QString, int> counts;
+    QQueue<QString> order;
+
+    /** scan identifiers (at least 3 characters), skipping others */
+    template<class F> static void tokens(const QString &text, F f);
+};
+
+#endif // COMPLETIONINDEX_H
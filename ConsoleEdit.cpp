@@ -23,6 +23,7 @@
 #include <SWI-Stream.h>
 
 #include "Swipl_IO.h"
+#include "ConsoleEdit.h"
 #include "do_events.h"
 #include "PREDICATE.h"
 #include "Completion.h"
@@ -35,6 +36,7 @@
 #include <QUrl>
 #include <QTime>
 #include <QRegExp>
+#include <QElapsedTimer>
 #include <QtDebug>
 #include <QAction>
 #include <QToolTip>
@@ -44,7 +46,11 @@
 #include <QMessageBox>
 #include <QMainWindow>
 #include <QApplication>
-#include <QStringListModel>
+#include <QStyle>
+#include <QPointer>
+#include <QListView>
+#include <QScrollBar>
+#include <QStringMatcher>
 
 /** peek color by index */
 static QColor ANSI2col(int c, bool highlight = false) { return Preferences::ANSI2col(c, highlight); }
@@ -57,11 +63,17 @@ ConsoleEdit::ConsoleEdit(int argc, char **argv, QWidget *parent)
 {
     qApp->setWindowIcon(QIcon(":/swipl.png"));
 
-    qRegisterMetaType<pfunc>("pfunc");
+    // bind the inter threads task queue to GUI thread
+    GuiTaskQueue::instance();
 
     setup();
     eng = new SwiPrologEngine(this);
 
+    // tooltips and completion data: from cache if available, validated (or
+    // loaded) in parallel with GUI construction
+    Completion::load_cache();
+    SwiPrologEngine::on_ready(Completion::warm_up);
+
     // wire up console IO
     connect(eng, SIGNAL(user_output(QString)), this, SLOT(user_output(QString)));
     connect(eng, SIGNAL(user_prompt(int, bool)), this, SLOT(user_prompt(int, bool)));
@@ -79,7 +91,22 @@ ConsoleEdit::ConsoleEdit(int argc, char **argv, QWidget *parent)
 void ConsoleEdit::add_thread(int id) {
     Q_ASSERT(id > 0);
     Q_ASSERT(thids.empty());
-    thids.append(id);
+    pqConsole::bind_thread(this, id);
+}
+
+/** called by FlushOutputEvents from engine thread at refresh rate
+ */
+void ConsoleEdit::flush_output() {
+    exec_sync s;
+    exec_func([&]() {
+        QTextCursor c = textCursor();
+        c.movePosition(c.End);
+        setTextCursor(c);
+        ensureCursorVisible();
+        do_events();
+        s.go();
+    });
+    s.stop();
 }
 
 /** this start an *interactor* console hosted in a QMainWindow
@@ -106,6 +133,7 @@ ConsoleEdit::ConsoleEdit(Swipl_IO* io)
 /** handle consoles list
  */
 ConsoleEdit::~ConsoleEdit() {
+    Completion::cancel(this);
     pqConsole::removeConsole(this);
 }
 
@@ -140,10 +168,18 @@ void ConsoleEdit::setup() {
     // added to handle reactive actions
     parsedStart = 0; //parsedLimit = -1;
 
-    qApp->installEventFilter(this);
+    // only this console's mouse moves, and only after they stop
+    viewport()->installEventFilter(this);
+    viewport()->setMouseTracking(true);
+    mouse_rest_timer = new QTimer(this);
+    mouse_rest_timer->setSingleShot(true);
+    mouse_rest_timer->setInterval(style()->styleHint(QStyle::SH_ToolTip_WakeUpDelay) / 2);
+    connect(mouse_rest_timer, SIGNAL(timeout()), this, SLOT(mouse_rest()));
     count_output = 0;
     update_refresh_rate = 100;
     preds = 0;
+    preds_model = 0;
+    last_word_docs = -1;
 
     Preferences p;
 
@@ -157,10 +193,20 @@ void ConsoleEdit::setup() {
     setLineWrapMode(p.wrapMode);
     setFont(p.console_font);
 
+    highlighter = new PrologHighlighter(document());
+
+    // cursor moves and selection changes coalesce into one update when events are processed
+    dirty = 0;
+    on_output = false;
+    update_timer = new QTimer(this);
+    update_timer->setSingleShot(true);
+    update_timer->setInterval(0);
+    connect(update_timer, SIGNAL(timeout()), this, SLOT(deferred_update()));
+
     connect(this, SIGNAL(cursorPositionChanged()), this, SLOT(onCursorPositionChanged()));
 
-    connect(this, SIGNAL(sig_run_function(pfunc)), this, SLOT(run_function(pfunc)));
     connect(this, SIGNAL(selectionChanged()), this, SLOT(selectionChanged()));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(occurs_scrolled()));
 
     fixedPosition = 0;
 }
@@ -172,6 +218,10 @@ void ConsoleEdit::keyPressEvent(QKeyEvent *event) {
     using namespace Qt;
     qDebug() << "keyPressEvent" << event;
 
+    // results of completion still running are stale
+    if (!event->text().isEmpty())
+        Completion::cancel(this);
+
     QTextCursor c = textCursor();
 
     bool on_completion = preds && preds->popup()->isVisible();
@@ -186,7 +236,6 @@ void ConsoleEdit::keyPressEvent(QKeyEvent *event) {
             event->ignore();
             return; // let the completer do default behavior
         default:
-            compinit(c);
             break;
         }
     }
@@ -356,11 +405,8 @@ void ConsoleEdit::keyPressEvent(QKeyEvent *event) {
                 goto _cmd_;
         }
 
-        if (on_completion) {
-            c.select(QTextCursor::WordUnderCursor);
-            preds->setCompletionPrefix(c.selectedText());
-            preds->popup()->setCurrentIndex(preds->completionModel()->index(0, 0));
-        }
+        if (on_completion)
+            compshow(textCursor(), preds_model->with_docs());
         else {
             // handle ^A+Del (clear buffer)
             c.movePosition(c.End);
@@ -376,9 +422,11 @@ void ConsoleEdit::keyPressEvent(QKeyEvent *event) {
         if (!cmd.isEmpty()) {
             cmd.replace(cmd.length() - 1, 1, '\n');
             add_history_line(cmd.left(cmd.length() - 1));
+            tokens.add_text(cmd);
         }
 
     _cmd_:
+        highlighter->set_input_start(-1);
         if (io)
             io->take_input(cmd);
         else
@@ -414,8 +462,14 @@ void ConsoleEdit::insertCompletion(QString completion) {
     int sep = completion.indexOf(" | ");
     if (sep > 0)    // remove description
         completion = completion.left(sep);
-    int extra = completion.length() - preds->completionPrefix().length();
-    textCursor().insertText(completion.right(extra));
+
+    // fuzzy matches don't start with prefix: replace it
+    QTextCursor c = textCursor();
+    c.movePosition(c.Left, c.KeepAnchor, preds_model->prefix().length());
+    c.insertText(completion);
+
+    int args = completion.indexOf('(');
+    CompletionIndex::used(args > 0 ? completion.left(args) : completion);
 }
 
 /** completion initialize
@@ -433,63 +487,85 @@ void ConsoleEdit::compinit(QTextCursor c) {
     }
     */
 
-    QStringList lpreds;
-    QString prefix = Completion::initialize(fixedPosition, c, lpreds);
-
-    if (!preds) {
-        preds = new t_Completion(new QStringListModel(lpreds));
-        preds->setWidget(this);
-        connect(preds, SIGNAL(activated(QString)), this, SLOT(insertCompletion(QString)));
-    }
-    else {
-        auto model = qobject_cast<QStringListModel*>(preds->model());
-        model->setStringList(lpreds);
-    }
-
-    preds->setCompletionPrefix(prefix);
-    preds->popup()->setCurrentIndex(preds->completionModel()->index(0, 0));
-
-    QRect cr = cursorRect();
-    cr.setWidth(300);
-    preds->complete(cr);
+    compshow(c, false);
 }
 
+/** completion with descriptions from helpidx
+ */
 void ConsoleEdit::compinit2(QTextCursor c) {
+    compshow(c, true);
+}
 
-    QStringList atoms;
-    QString prefix = Completion::initialize(fixedPosition, c, atoms);
+/** plain identifiers are served from the index - fuzzy ranked from 2 characters - and
+ *  from tokens in console buffer, other contexts by complete_input on a background engine
+ *  the model is already filtered: the completer must not filter again
+ */
+void ConsoleEdit::compshow(QTextCursor c, bool with_docs) {
 
     if (!preds) {
-        preds = new t_Completion(new QStringListModel());
+        preds_model = new CompletionModel(this);
+        preds = new t_Completion(preds_model, this);
         preds->setWidget(this);
+        if (auto v = qobject_cast<QListView*>(preds->popup()))
+            v->setUniformItemSizes(true);
         connect(preds, SIGNAL(activated(QString)), this, SLOT(insertCompletion(QString)));
     }
 
-    QStringList lpreds;
-    foreach (auto a, atoms) {
-        auto p = Completion::pred_docs.constFind(a);
-        if (p != Completion::pred_docs.end())
-            foreach (auto d, p.value()) {
-                QStringList la;
-                for (int n = 0; n < d.first; ++n)
-                    la.append(QString('A' + n));
-                if (!la.isEmpty())
-                    lpreds.append(QString("%1(%2) | %3").arg(a).arg(la.join(", ")).arg(d.second));
-                else
-                    lpreds.append(QString("%1 | %2").arg(a).arg(d.second));
-            }
-        else
-            lpreds.append(a);
+    QString before, after;
+    if (!Completion::context(fixedPosition, c, before, after)) {
+        preds->popup()->hide();
+        return;
     }
 
-    auto model = qobject_cast<QStringListModel*>(preds->model());
-    model->setStringList(lpreds);
+    QString prefix;
+    if (Completion::word_prefix(fixedPosition, c, prefix)) {
+        // atoms from index, then variables and atoms from console buffer on top
+        QStringList local = tokens.complete(prefix, max_local_tokens, before + " " + after);
+        bool atom = prefix[0].isLower();
+        if (!atom || !(prefix.length() < 2 ? preds_model->filter(prefix, with_docs) : preds_model->rank(prefix, with_docs)))
+            preds_model->assign(QStringList(), prefix, with_docs);
+        preds_model->set_local(local);
+        if (preds_model->rowCount()) {
+            compopen(with_docs);
+            return;
+        }
+    }
+
+    QStringList strings;
+    if (last_completion.filter(before, prefix, strings)) {
+        preds_model->assign(strings, prefix, with_docs);
+        compopen(with_docs);
+        return;
+    }
 
-    preds->setCompletionPrefix(prefix);
+    // never block typing: the popup opens when results arrive, if still current
+    QPointer<ConsoleEdit> self(this);
+    int pos = c.position();
+    Completion::request(this, before, after, [=](QString prefix, QStringList strings) {
+        if (self && self->textCursor().position() == pos) {
+            self->last_completion.before = before;
+            self->last_completion.prefix = prefix;
+            self->last_completion.strings = strings;
+            self->preds_model->assign(strings, prefix, with_docs);
+            self->compopen(with_docs);
+        }
+    });
+}
+
+/** show - or hide if empty - the popup on current model
+ */
+void ConsoleEdit::compopen(bool with_docs) {
+
+    if (!preds_model->rowCount()) {
+        preds->popup()->hide();
+        return;
+    }
+
+    preds->setCompletionPrefix(QString());
     preds->popup()->setCurrentIndex(preds->completionModel()->index(0, 0));
 
     QRect cr = cursorRect();
-    cr.setWidth(400);
+    cr.setWidth(with_docs ? 400 : 300);
     preds->complete(cr);
 }
 
@@ -501,6 +577,17 @@ void ConsoleEdit::focusInEvent(QFocusEvent *e) {
     ConsoleEditBase::focusInEvent(e);
 }
 
+/** record first paint in startup timeline
+ */
+void ConsoleEdit::paintEvent(QPaintEvent *e) {
+    static bool painted;
+    if (!painted) {
+        painted = true;
+        startup_timeline::mark("first paint");
+    }
+    ConsoleEditBase::paintEvent(e);
+}
+
 /** filter out insertion when cursor is not in editable position
  */
 void ConsoleEdit::insertFromMimeData(const QMimeData *source) {
@@ -525,6 +612,8 @@ void ConsoleEdit::user_output(QString text) {
     text.replace("\r\n", "\n");
 #endif
 
+    tokens.add_text(text);
+
     QTextCursor c = textCursor();
     if (status == wait_input)
         c.setPosition(promptPosition);
@@ -616,16 +705,18 @@ void ConsoleEdit::user_prompt(int threadId, bool tty) {
 
     is_tty = tty;
 
-    Completion::helpidx();
-
     QTextCursor c = textCursor();
     c.movePosition(QTextCursor::End);
     fixedPosition = c.position();
+    highlighter->set_input_start(fixedPosition);
+    last_completion.clear();
     setTextCursor(c);
     ensureCursorVisible();
 
-    if (status == idle)
+    if (status == idle) {
+        startup_timeline::mark("first prompt");
         emit engine_ready();
+    }
 
     status = wait_input;
 
@@ -702,6 +793,7 @@ void ConsoleEdit::command_do() {
 
     c.movePosition(QTextCursor::End);
     promptPosition = fixedPosition = c.position();
+    highlighter->set_input_start(-1);
 
     emit user_input(cmd);
 }
@@ -722,17 +814,24 @@ bool ConsoleEdit::event(QEvent *event) {
     return ConsoleEditBase::event(event);
 }
 
-/** sense word under cursor for tooltip display
+/** sense mouse moves on viewport: the lookup is delayed until mouse rests
  */
 bool ConsoleEdit::eventFilter(QObject *, QEvent *event) {
     if (event->type() == QEvent::MouseMove) {
-        QTextCursor c = cursorForPosition(static_cast<QMouseEvent*>(event)->pos());
-        set_cursor_tip(c);
-        clickable_message_line(c, true);
+        mouse_rest_pos = static_cast<QMouseEvent*>(event)->pos();
+        mouse_rest_timer->start();
     }
     return false;
 }
 
+/** sense word under cursor for tooltip display, and message source link
+ */
+void ConsoleEdit::mouse_rest() {
+    QTextCursor c = cursorForPosition(mouse_rest_pos);
+    set_cursor_tip(c);
+    clickable_message_line(c, true);
+}
+
 /** the user identifying label is attached somewhere to parents chain
  */
 QString ConsoleEdit::titleLabel() {
@@ -759,27 +858,59 @@ bool ConsoleEdit::can_close() {
 }
 
 /** display different cursor where editing available
+ *  interaction flags must follow immediately (keys are processed next), but only on transitions
+ *  other work is deferred to when pending events have been processed
  */
 void ConsoleEdit::onCursorPositionChanged() {
-    QTextCursor c = textCursor();
-    set_cursor_tip(c);
-    if (fixedPosition > c.position()) {
-        viewport()->setCursor(Qt::OpenHandCursor);
-        set_editable(false);
-        clickable_message_line(c, true);
-    } else {
-        set_editable(true);
-        viewport()->setCursor(Qt::IBeamCursor);
+    bool output = fixedPosition > textCursor().position();
+    if (output != on_output) {
+        on_output = output;
+        viewport()->setCursor(output ? Qt::OpenHandCursor : Qt::IBeamCursor);
+        set_editable(!output);
     }
+    schedule_update(dirty_cursor);
+}
 
-    if (pmatched.size()) {
-        pmatched.format_both(c);
-        pmatched = ParenMatching::range();
+/** collect what must be refreshed, to be done once after a burst of events
+ */
+void ConsoleEdit::schedule_update(int what) {
+    dirty |= what;
+    if (!update_timer->isActive())
+        update_timer->start();
+}
+
+/** tooltip, message source, matching parenthesis and occurrences
+ */
+void ConsoleEdit::deferred_update() {
+    int what = dirty;
+    dirty = 0;
+
+    if (what & dirty_cursor) {
+        QTextCursor c = textCursor();
+        set_cursor_tip(c);
+        if (on_output)
+            clickable_message_line(c, true);
+
+        ParenMatching pm(c);
+        if (pm || pmatched.size()) {
+            pmatched = pm.positions;
+            parens.clear();
+            if (pm) {
+                QTextCharFormat bold = pmatched.bold();
+                parens.append(ExtraSelection {ParenMatching::range(pmatched.beg, pmatched.beg + 1).select(c), bold});
+                parens.append(ExtraSelection {ParenMatching::range(pmatched.end, pmatched.end + 1).select(c), bold});
+            }
+            what |= dirty_selections;
+        }
     }
 
-    ParenMatching pm(c);
-    if (pm)
-        (pmatched = pm.positions).format_both(c, pmatched.bold());
+    if (what & dirty_occurs) {
+        occurs_update();
+        what |= dirty_selections;
+    }
+
+    if (what & dirty_selections)
+        setExtraSelections(parens + occurs);
 }
 
 /** check if line content is appropriate, then highlight or open editor on it */
@@ -837,10 +968,16 @@ void ConsoleEdit::clickable_message_line(QTextCursor c, bool highlight) {
 }
 #endif
 
-/** setup tooltip info
+/** setup tooltip info, only when word changes
  */
 void ConsoleEdit::set_cursor_tip(QTextCursor c) {
-    last_tip = Completion::pred_tip(c);
+    c.select(c.WordUnderCursor);
+    QString w = c.selectedText();
+    if (w == last_word && last_word_docs == Completion::pred_docs_version)
+        return;
+    last_word = w;
+    last_word_docs = Completion::pred_docs_version;
+    last_tip = Completion::pred_tip(w);
     if (!last_tip.isEmpty())
         setToolTip(last_tip);
 }
@@ -870,16 +1007,16 @@ void ConsoleEdit::onConsoleMenuActionMap(const QString& action) {
                 {   SwiPrologEngine::in_thread e;
                     int t = PL_thread_self();
                     Q_ASSERT(!target->thids.contains(t));
-                    target->thids.append(t);
+                    pqConsole::bind_thread(target, t);
                     try {
                         PL_set_prolog_flag("console_thread", PL_INTEGER, t);
-                        PlCall(action.toStdWString().data());
+                        PlCall(WCS(action));
                         for (int c = 0; c < 100; c++)
                             do_events(10);
                     } catch(PlException e) {
                         qDebug() << CCP(e);
                     }
-                    target->thids.removeLast();
+                    pqConsole::bind_thread(target, t, false);
                 }
                 return;
             }
@@ -966,31 +1103,53 @@ void ConsoleEdit::query_run(QString module, QString call) {
         query_run(module + ":" + call);
 }
 
-ConsoleEdit::exec_sync::exec_sync(int timeout_ms) : timeout_ms(timeout_ms) {
+/** contention accounting of GUI rendezvous */
+static sync_point exec_sync_point("ConsoleEdit::exec_sync");
+
+/** rendezvous between a requesting (Prolog) thread and the GUI thread
+ */
+ConsoleEdit::exec_sync::exec_sync(int timeout_ms)
+    : rv(new state), timeout_ms(timeout_ms)
+{
     stop_ = CT;
-    go_ = 0;
 }
-void ConsoleEdit::exec_sync::stop() {
+bool ConsoleEdit::exec_sync::stop() {
     Q_ASSERT(CT == stop_);
-    for ( ; ; ) {
-        {   QMutexLocker lk(&sync);
-            if (go_)
-                break;
+    std::exception_ptr error;
+    {   sync_wait w(exec_sync_point);
+        QMutexLocker lk(&rv->sync);
+        QElapsedTimer elapsed;
+        elapsed.start();
+        if (!rv->done)
+            w.blocked();
+        while (!rv->done) {
+            if (timeout_ms < 0)
+                rv->done_cond.wait(&rv->sync);
+            else {
+                qint64 left = timeout_ms - elapsed.elapsed();
+                if (left <= 0)
+                    return false;
+                rv->done_cond.wait(&rv->sync, ulong(left));
+            }
         }
-        SwiPrologEngine::msleep(10);
+        error = rv->error;
     }
-    //Q_ASSERT(go_ && go_ != stop_);
+    if (error)
+        std::rethrow_exception(error);
+    return true;
 }
 void ConsoleEdit::exec_sync::go() {
-    Q_ASSERT(go_ == 0);
-    Q_ASSERT(stop_ != 0);
-    auto t = CT;
-    if (stop_ != t) {
-        QMutexLocker lk(&sync);
-        go_ = t;
-    }
-    else
-        go_ = t;
+    QMutexLocker lk(&rv->sync);
+    Q_ASSERT(!rv->done);
+    rv->done = true;
+    rv->done_cond.wakeAll();
+}
+void ConsoleEdit::exec_sync::fail() {
+    QMutexLocker lk(&rv->sync);
+    Q_ASSERT(!rv->done);
+    rv->error = std::current_exception();
+    rv->done = true;
+    rv->done_cond.wakeAll();
 }
 
 void ConsoleEdit::setSource(const QUrl &name) {
@@ -1007,35 +1166,65 @@ void ConsoleEdit::html_write(QString html) {
 }
 
 void ConsoleEdit::set_editable(bool allow) {
-    qDebug() << "set_editable" << allow << "before" << textInteractionFlags();
-    if (allow)
-        setTextInteractionFlags(Qt::TextEditorInteraction | Qt::TextBrowserInteraction);
-    else
-        setTextInteractionFlags((Qt::TextEditorInteraction | Qt::TextBrowserInteraction) & ~Qt::TextEditable);
-    qDebug() << "after" << textInteractionFlags();
+    Qt::TextInteractionFlags f = Qt::TextEditorInteraction | Qt::TextBrowserInteraction;
+    if (!allow)
+        f &= ~Qt::TextEditable;
+    if (f != textInteractionFlags())
+        setTextInteractionFlags(f);
 }
 
+/** highlight related 'symbols' on selection
+ *  only occurrences near the viewport, refreshed on scroll: the document is never changed
+ */
 void ConsoleEdit::selectionChanged()
 {
     QTextCursor c = textCursor();
-    if (c.hasSelection()) {
-        QString csel = c.selectedText();
-        c.movePosition(c.Start);
-        QList<ExtraSelection> lsel;
+    QString csel = c.hasSelection() ? c.selectedText() : QString();
+
+    // multi line selections are not searched
+    if (csel.contains(QChar::ParagraphSeparator))
+        csel.clear();
+
+    if (csel != occurs_text) {
+        occurs_text = csel;
+        schedule_update(dirty_occurs);
+    }
+}
+
+/** find occurrences of selected text in blocks visible, plus a margin
+ */
+void ConsoleEdit::occurs_update()
+{
+    QList<ExtraSelection> &lsel = occurs;
+    lsel.clear();
+
+    if (!occurs_text.isEmpty()) {
+        QTextBlock
+            b = cursorForPosition(QPoint(0, 0)).block(),
+            e = cursorForPosition(QPoint(viewport()->width(), viewport()->height())).block();
+        for (int m = 0; m < occurs_margin && b.previous().isValid(); ++m)
+            b = b.previous();
+        for (int m = 0; m < occurs_margin && e.next().isValid(); ++m)
+            e = e.next();
+
+        QStringMatcher matcher(occurs_text, Qt::CaseInsensitive);
         QTextCharFormat bold = ParenMatching::range::bold();
-        for ( ; ; ) {
-            c = document()->find(csel, c);
-            if (c.isNull())
-                break;
-            lsel.append(ExtraSelection {c, bold});
-            c.setCharFormat(bold);
+        QTextCursor c(document());
+        for (e = e.next(); b != e; b = b.next()) {
+            QString t = b.text();
+            for (int p = 0; (p = matcher.indexIn(t, p)) >= 0; p += occurs_text.length()) {
+                c.setPosition(b.position() + p);
+                c.setPosition(b.position() + p + occurs_text.length(), c.KeepAnchor);
+                lsel.append(ExtraSelection {c, bold});
+            }
         }
-        setExtraSelections(lsel);
-    }
-    else {
-        QTextCharFormat clear = QTextCharFormat();
-        foreach (ExtraSelection s, extraSelections())
-            s.cursor.setCharFormat(clear);
-        extraSelections().clear();
     }
 }
+
+/** viewport moved: recompute occurrences if a selection is highlighted
+ */
+void ConsoleEdit::occurs_scrolled()
+{
+    if (!occurs_text.isEmpty())
+        schedule_update(dirty_occurs);
+}
@@ -24,7 +24,10 @@
 #define CONSOLEEDIT_H
 
 #include <QEvent>
+#include <QTimer>
 #include <QCompleter>
+#include <QSharedPointer>
+#include <exception>
 
 // make this definition available in client projects
 #define PQCONSOLE_BROWSER
@@ -43,14 +46,16 @@
 
 #include "SwiPrologEngine.h"
 #include "Completion.h"
+#include "CompletionIndex.h"
 #include "ParenMatching.h"
+#include "PrologHighlighter.h"
 
 class Swipl_IO;
 
 /** client side of command line interface
   * run in GUI thread, sync using SwiPrologEngine interface
   */
-class PQCONSOLESHARED_EXPORT ConsoleEdit : public ConsoleEditBase {
+class PQCONSOLESHARED_EXPORT ConsoleEdit : public ConsoleEditBase, public ConsoleTarget {
     Q_OBJECT
     Q_PROPERTY(int updateRefreshRate READ updateRefreshRate WRITE setUpdateRefreshRate)
 
@@ -81,7 +86,10 @@ public:
 
     /** should always match PL_thread_id() ... */
     int thread_id() const { return thids[0]; }
-    void add_thread(int id);
+    virtual void add_thread(int id);
+
+    /** move cursor to end and process pending events, in GUI thread */
+    virtual void flush_output();
 
     /** remove all text */
     void tty_clear();
@@ -96,19 +104,37 @@ public:
     /** closeEvent only called for top level widgets */
     bool can_close();
 
-    /** 4. attempt to run generic code inter threads */
-    void exec_func(pfunc f) { emit sig_run_function(f); }
+    /** 4. run generic code in GUI thread, queued when called from another thread */
+    template<class F> void exec_func(const F &f) { GuiTaskQueue::post(f); }
 
-    /** 5. helper syncronization for modal loop */
+    /** 5. helper syncronization for modal loop
+     *  the caller blocks in stop() until the GUI side issues go() (or fail())
+     *  copies share the same rendezvous, so a lambda can capture it by value
+     */
     struct PQCONSOLESHARED_EXPORT exec_sync {
-        exec_sync(int timeout_ms = 100);
+        exec_sync(int timeout_ms = -1);
+
+        /** wait for go() - forever when timeout_ms < 0 - return false on timeout
+         *  rethrow in caller thread the exception captured by fail()
+         */
+        bool stop();
 
-        void stop();
+        /** release the waiting thread */
         void go();
 
+        /** release the waiting thread, passing the exception being handled */
+        void fail();
+
     private:
-        QThread *stop_, *go_;
-        QMutex sync;
+        struct state {
+            QMutex sync;
+            QWaitCondition done_cond;
+            bool done;
+            std::exception_ptr error;
+            state() : done(false) {}
+        };
+        QSharedPointer<state> rv;
+        QThread *stop_;
         int timeout_ms;
     };
 
@@ -148,6 +174,9 @@ protected:
     /** support completion */
     virtual void focusInEvent(QFocusEvent *e);
 
+    /** record first paint in startup timeline */
+    virtual void paintEvent(QPaintEvent *e);
+
     /** filter out insertion when cursor is not in editable position */
     virtual void insertFromMimeData(const QMimeData *source);
 
@@ -162,9 +191,13 @@ protected:
     /** handle tooltip placing */
     virtual bool event(QEvent *event);
 
-    /** sense word under cursor for tooltip display */
+    /** sense mouse moves on viewport, for tooltip display */
     virtual bool eventFilter(QObject *, QEvent *event);
 
+    /** mouse tracking, debounced to tooltip delay */
+    QTimer *mouse_rest_timer;
+    QPoint mouse_rest_pos;
+
     /** output/input text attributes */
     QTextCharFormat output_text_fmt, input_text_fmt;
 
@@ -190,14 +223,23 @@ protected:
     /** will eventually become with help from the kernel */
     typedef QCompleter t_Completion;
     t_Completion *preds;
+    CompletionModel *preds_model;
+
+    /** complete_input results at this prompt */
+    Completion::results last_completion;
+
+    /** identifiers from input and recent output */
+    CompletionTokens tokens;
+    enum { max_local_tokens = 32 };
     QStringList lmodules;
 
     /** factorize code, attempt to get visual clue from QCompleter */
     void compinit(QTextCursor c);
     void compinit2(QTextCursor c);
 
-    /** associated thread id (see PL_thread_self()) */
-    QList<int> thids;
+    /** filter candidates at cursor, then show - or hide if none - the popup */
+    void compshow(QTextCursor c, bool with_docs);
+    void compopen(bool with_docs);
 
     /** wiring etc... */
     void setup();
@@ -205,17 +247,18 @@ protected:
 
     /** tooltips & completion support, from helpidx.pl */
     QString last_word, last_tip;
+    int last_word_docs;     // Completion::pred_docs_version of last_tip
     void set_cursor_tip(QTextCursor c);
 
-    /** attempt to track *where* to place outpout */
-    enum e_status { idle, wait_input, running, closing, eof };
-    e_status status;
+    /** color Prolog syntax of user input */
+    PrologHighlighter *highlighter;
+
+    /** track *where* to place outpout (see also ConsoleTarget::status) */
     int promptPosition;
     bool is_tty;
 
     // while solving inter threads problems...
-    friend class SwiPrologEngine;
-    friend class Swipl_IO;
+    friend class pqConsole;
 
     /** need to sense the processor type to execute code
      *  bypass IO based execution, direct calling
@@ -246,6 +289,22 @@ protected:
 
     /** keep last matched pair */
     ParenMatching::range pmatched;
+    QList<ExtraSelection> parens;
+
+    /** selected text highlighted in blocks around the viewport */
+    QString occurs_text;
+    QList<ExtraSelection> occurs;
+    enum { occurs_margin = 50 };
+    void occurs_update();
+
+    /** pending work after cursor or selection changes */
+    enum { dirty_cursor = 1, dirty_occurs = 2, dirty_selections = 4 };
+    int dirty;
+    QTimer *update_timer;
+    void schedule_update(int what);
+
+    /** cursor last seen in output area */
+    bool on_output;
 
 public slots:
 
@@ -256,9 +315,6 @@ public slots:
     void onConsoleMenuAction();
     void onConsoleMenuActionMap(const QString &action);
 
-    /** 2. attempt to run generic code inter threads */
-    void run_function(pfunc f) { f(); }
-
 protected slots:
 
     /** send text to output */
@@ -282,14 +338,20 @@ protected slots:
     /** highlight related 'symbols' on selection */
     void selectionChanged();
 
+    /** keep occurrences highlighted while scrolling */
+    void occurs_scrolled();
+
+    /** process cursor and selection changes collected since last call */
+    void deferred_update();
+
+    /** mouse stopped moving: lookup tooltip and message source */
+    void mouse_rest();
+
 signals:
 
     /** issued to serve prompt */
     void user_input(QString);
 
-    /** 3. attempt to run generic code inter threads */
-    void sig_run_function(pfunc f);
-
     /** notify SWI-Prolog has been initialized, ready to run */
     void engine_ready();
 };
@@ -0,0 +1,51 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CONSOLETARGET_H
+#define CONSOLETARGET_H
+
+#include "pqConsole_global.h"
+#include <QList>
+
+/** what the engine side requires from a console front end
+ *  keeps SwiPrologEngine and Swipl_IO independent from widgets
+ */
+struct PQCONSOLECORE_EXPORT ConsoleTarget {
+
+    ConsoleTarget() : status(idle) {}
+    virtual ~ConsoleTarget() {}
+
+    /** attempt to track *where* to place outpout */
+    enum e_status { idle, wait_input, running, closing, eof };
+    e_status status;
+
+    /** associated thread id (see PL_thread_self()) */
+    QList<int> thids;
+
+    /** bind the (first) Prolog thread served */
+    virtual void add_thread(int id) = 0;
+
+    /** make latest output visible - called from engine thread */
+    virtual void flush_output() = 0;
+};
+
+#endif // CONSOLETARGET_H
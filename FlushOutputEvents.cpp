@@ -21,13 +21,8 @@
 */
 
 #include "FlushOutputEvents.h"
-#include "ConsoleEdit.h"
-#include "do_events.h"
 
-#include <QDebug>
-#include "PREDICATE.h"
-
-FlushOutputEvents::FlushOutputEvents(ConsoleEdit *target, int msec_delta_refresh)
+FlushOutputEvents::FlushOutputEvents(ConsoleTarget *target, int msec_delta_refresh)
     : target(target),
       msec_delta_refresh(msec_delta_refresh)
 {
@@ -36,19 +31,7 @@ FlushOutputEvents::FlushOutputEvents(ConsoleEdit *target, int msec_delta_refresh
 
 void FlushOutputEvents::flush() {
     if (measure_calls.elapsed() >= msec_delta_refresh) {
-
-        ConsoleEdit::exec_sync s;
-
-        target->exec_func([&]() {
-            QTextCursor c = target->textCursor();
-            c.movePosition(c.End);
-            target->setTextCursor(c);
-            target->ensureCursorVisible();
-            do_events();
-            s.go();
-        });
-        s.stop();
-
+        target->flush_output();
         measure_calls.restart();
     }
 }
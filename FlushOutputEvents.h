@@ -23,19 +23,18 @@
 #ifndef FLUSHOUTPUTEVENTS_H
 #define FLUSHOUTPUTEVENTS_H
 
-#include "pqConsole_global.h"
+#include "ConsoleTarget.h"
 #include <QElapsedTimer>
 #include <QThread>
-class ConsoleEdit;
 
 /** factorize output flushing interface
  */
-struct PQCONSOLESHARED_EXPORT FlushOutputEvents {
+struct PQCONSOLECORE_EXPORT FlushOutputEvents {
 
-    FlushOutputEvents(ConsoleEdit *target = 0, int msec_delta_refresh = 10);
+    FlushOutputEvents(ConsoleTarget *target = 0, int msec_delta_refresh = 10);
     void flush();
 
-    ConsoleEdit *target;
+    ConsoleTarget *target;
     QElapsedTimer measure_calls;
     int msec_delta_refresh;
 };
@@ -0,0 +1,107 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "GuiTaskQueue.h"
+
+/** event type used to wake up the consumer */
+static const QEvent::Type wakeup_event_type = QEvent::Type(QEvent::User + 1);
+
+/** the queue, constructed lazily by the first user
+ */
+static QAtomicPointer<GuiTaskQueue> the_queue;
+
+/** contention accounting */
+static sync_point queue_sync_point("GuiTaskQueue::sync");
+
+GuiTaskQueue::GuiTaskQueue()
+    : sync(&queue_sync_point), head(0), count(0), wakeup_posted(false)
+{
+}
+
+/** construct on first use, and bind to GUI thread
+ */
+GuiTaskQueue *GuiTaskQueue::instance() {
+    GuiTaskQueue *q = the_queue.loadAcquire();
+    if (!q) {
+        GuiTaskQueue *n = new GuiTaskQueue;
+        n->moveToThread(QCoreApplication::instance()->thread());
+        if (the_queue.testAndSetOrdered(0, n))
+            q = n;
+        else {
+            delete n;
+            q = the_queue.loadAcquire();
+        }
+    }
+    return q;
+}
+
+void GuiTaskQueue::wakeup() {
+    QCoreApplication::postEvent(this, new QEvent(wakeup_event_type));
+}
+
+/** run queued tasks in order, one at time, outside the lock
+ *  wakeup_posted means a wakeup event is pending: it's cleared on entry, and before running a task
+ *  a new one is posted if tasks remain. A task running a nested event loop (modal dialogs, do_events)
+ *  then lets that loop reenter here and serve the rest of the queue.
+ */
+void GuiTaskQueue::customEvent(QEvent *event) {
+    if (event->type() != wakeup_event_type)
+        return;
+
+    {   sync_locker lk(&sync);
+        wakeup_posted = false;
+    }
+
+    for (int n = 0; n < max_batch; ++n) {
+        gui_task t;
+        pfunc f;
+        bool wake = false;
+        {   sync_locker lk(&sync);
+            if (count > 0) {
+                t.take(ring[head]);
+                head = (head + 1) % capacity;
+                --count;
+            }
+            else if (!overflow.isEmpty())
+                f = overflow.takeFirst();
+            else
+                return;
+            if ((count > 0 || !overflow.isEmpty()) && !wakeup_posted)
+                wake = wakeup_posted = true;
+        }
+        if (wake)
+            wakeup();
+        if (f)
+            f();
+        else
+            t.run();
+    }
+
+    // still not empty: let other events be served before continuing
+    bool wake = false;
+    {   sync_locker lk(&sync);
+        if ((count > 0 || !overflow.isEmpty()) && !wakeup_posted)
+            wake = wakeup_posted = true;
+    }
+    if (wake)
+        wakeup();
+}
@@ -0,0 +1,167 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef GUITASKQUEUE_H
+#define GUITASKQUEUE_H
+
+#include "pqConsole_global.h"
+#include "SyncMetrics.h"
+
+#include <QMutex>
+#include <QEvent>
+#include <QObject>
+#include <QThread>
+#include <QCoreApplication>
+#include <functional>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/** 1. attempt to run generic code inter threads */
+typedef std::function<void()> pfunc;
+
+/** a closure to be run in GUI thread, stored in place when small enough
+ *  (lambdas capturing a few references or values), on heap otherwise
+ */
+class PQCONSOLECORE_EXPORT gui_task {
+public:
+
+    gui_task() : ops(0) {}
+    ~gui_task() { clear(); }
+
+    /** store a copy of f */
+    template<class F> void assign(const F &f) {
+        clear();
+        place(f, std::integral_constant<bool, sizeof(F) <= sizeof(storage)>());
+    }
+
+    /** move content from other, leaving it empty */
+    void take(gui_task &other) {
+        clear();
+        if ((ops = other.ops) != 0) {
+            ops->move(&storage, &other.storage);
+            other.ops = 0;
+        }
+    }
+
+    void run() { if (ops) ops->run(&storage); }
+    void clear() { if (ops) { ops->destroy(&storage); ops = 0; } }
+
+private:
+
+    struct ops_t {
+        void (*run)(void *p);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *p);
+    };
+
+    template<class F> struct inline_ops {
+        static void run(void *p) { (*static_cast<F*>(p))(); }
+        static void move(void *d, void *s) { F *f = static_cast<F*>(s); new (d) F(std::move(*f)); f->~F(); }
+        static void destroy(void *p) { static_cast<F*>(p)->~F(); }
+        static const ops_t table;
+    };
+    template<class F> struct heap_ops {
+        static F*& ptr(void *p) { return *static_cast<F**>(p); }
+        static void run(void *p) { (*ptr(p))(); }
+        static void move(void *d, void *s) { new (d) F*(ptr(s)); }
+        static void destroy(void *p) { delete ptr(p); }
+        static const ops_t table;
+    };
+
+    template<class F> void place(const F &f, std::true_type) {
+        new (&storage) F(f);
+        ops = &inline_ops<F>::table;
+    }
+    template<class F> void place(const F &f, std::false_type) {
+        new (&storage) F*(new F(f));
+        ops = &heap_ops<F>::table;
+    }
+
+    const ops_t *ops;
+    union { void *p[8]; double d; long long l; } storage;
+
+    gui_task(const gui_task &);
+    gui_task& operator=(const gui_task &);
+};
+
+template<class F> const gui_task::ops_t gui_task::inline_ops<F>::table = {
+    &gui_task::inline_ops<F>::run, &gui_task::inline_ops<F>::move, &gui_task::inline_ops<F>::destroy
+};
+template<class F> const gui_task::ops_t gui_task::heap_ops<F>::table = {
+    &gui_task::heap_ops<F>::run, &gui_task::heap_ops<F>::move, &gui_task::heap_ops<F>::destroy
+};
+
+/** multiple producers (Prolog threads) - single consumer (GUI thread) queue of closures
+ *  tasks are kept in a preallocated ring, and drained in batches:
+ *  at most one wakeup event is pending at any time
+ */
+class PQCONSOLECORE_EXPORT GuiTaskQueue : public QObject {
+    Q_OBJECT
+public:
+
+    /** the single queue, living in GUI thread */
+    static GuiTaskQueue *instance();
+
+    /** run f in GUI thread: directly when already there, else queued */
+    template<class F> static void post(const F &f) {
+        if (QThread::currentThread() == QCoreApplication::instance()->thread())
+            f();
+        else
+            instance()->enqueue(f);
+    }
+
+protected:
+
+    /** drain tasks */
+    virtual void customEvent(QEvent *event);
+
+private:
+
+    GuiTaskQueue();
+
+    enum { capacity = 256, max_batch = 64 };
+
+    template<class F> void enqueue(const F &f) {
+        bool wake;
+        {   sync_locker lk(&sync);
+            if (count < capacity && overflow.isEmpty())
+                ring[(head + count++) % capacity].assign(f);
+            else
+                overflow.append(f);
+            wake = !wakeup_posted;
+            wakeup_posted = true;
+        }
+        if (wake)
+            wakeup();
+    }
+
+    void wakeup();
+
+    sync_mutex sync;
+    gui_task ring[capacity];
+    int head, count;            // syncronized !
+    QList<pfunc> overflow;      // syncronized ! used only when ring is full
+    bool wakeup_posted;         // syncronized ! a wakeup event is pending
+};
+
+#endif // GUITASKQUEUE_H
@@ -39,28 +39,93 @@ typedef void* VP;
 #define CT QThread::currentThread()
 
 #include <QString>
+#include <QVarLengthArray>
 
 inline CCP S(const PlTerm &T) { return T; }
 
+/** wide C string from QString, to be passed to SWI-Prolog API:
+  * where wchar_t is UTF-16 (Windows) the QString storage is used as is,
+  * else widened to UCS-4 in a stack buffer for short strings
+  */
+class WCS {
+public:
+    WCS(const QString &s) {
+        if (sizeof(wchar_t) == sizeof(ushort)) {
+            p = reinterpret_cast<WCP>(s.utf16());
+            n = s.length();
+        } else {
+            b.resize(s.length() + 1);
+            n = s.toWCharArray(b.data());
+            b[n] = 0;
+            p = b.constData();
+        }
+    }
+    operator WCP() const { return p; }
+    size_t length() const { return size_t(n); }
+private:
+    QVarLengthArray<wchar_t, 256> b;
+    WCP p;      // can point into b: not copyable
+    int n;
+    Q_DISABLE_COPY(WCS)
+};
+
+/** atom from QString: ISO Latin-1 text (the common case) is narrowed on stack,
+  * avoiding any wide intermediate
+  */
 inline PlAtom W(const QString &s) {
-    return PlAtom(s.toStdWString().data());
+    int n = s.length();
+    const ushort *u = s.utf16();
+    QVarLengthArray<char, 256> l(n);
+    int i;
+    for (i = 0; i < n && u[i] < 256; ++i)
+        l[i] = char(u[i]);
+    if (i == n)
+        return PlAtom(PL_new_atom_nchars(size_t(n), l.constData()));
+    WCS w(s);
+    return PlAtom(PL_new_atom_wchars(w.length(), w));
 }
 inline PlAtom A(QString s) {
     return W(s);
 }
 
+/** interned atom for a fixed name, looked up once per call site:
+  * for literals only, as FA("true")
+  */
+#define FA(name) ([]() -> PlAtom { static atom_t a_ = PL_new_atom(name); return PlAtom(a_); }())
+
+/** SWI-Prolog string from QString: for transient user text,
+  * that would otherwise grow the atom table
+  */
+inline PlTerm w2s(const QString &s) {
+    PlTerm t;
+    WCS w(s);
+    if (!PL_unify_wchars(t.ref, PL_STRING, w.length(), w))
+        throw PlResourceError("memory");
+    return t;
+}
+
+/** text of any term: atoms and strings in ISO Latin-1 are read in place
+  */
 inline QString t2w(PlTerm t) {
-    return QString::fromWCharArray(WCP(t));
+    size_t len;
+    char *s;
+    if (PL_get_nchars(t, &len, &s, CVT_ATOM|CVT_STRING))
+        return QString::fromLatin1(s, int(len));
+    wchar_t *w;
+    if (PL_get_wchars(t, &len, &w, CVT_ALL|CVT_WRITEQ|BUF_RING))
+        return QString::fromWCharArray(w, int(len));
+    throw PlTypeError("text", t);
 }
 
 /** fast interface to get a string out of a ground term.
   * thanks Jan !
   */
 inline QString serialize(PlTerm t) {
+    size_t len;
     wchar_t *s;
 
-    if ( PL_get_wchars(t, NULL, &s, CVT_WRITEQ|BUF_RING) )
-      return QString::fromWCharArray(s);
+    if ( PL_get_wchars(t, &len, &s, CVT_WRITEQ|BUF_RING) )
+      return QString::fromWCharArray(s, int(len));
 
     throw PlTypeError("text", t);
     PL_THROWN(NULL);
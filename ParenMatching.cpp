@@ -23,44 +23,307 @@
 #include "ParenMatching.h"
 #include <QTextStream>
 #include <QTextBlock>
+#include <string.h>
+
+int BlockInfo::kind(ushort c, bool &open) {
+    switch (c) {
+    case '(': open = true;  return 0;
+    case ')': open = false; return 0;
+    case '[': open = true;  return 1;
+    case ']': open = false; return 1;
+    case '{': open = true;  return 2;
+    case '}': open = false; return 2;
+    }
+    return -1;
+}
+
+/** lexer state left at end of previous block
+ *  PrologHighlighter keeps it in userState, else use what was last scanned there
+ */
+static int state_before(QTextBlock b) {
+    QTextBlock p = b.previous();
+    if (!p.isValid())
+        return BlockInfo::s_normal;
+    if (p.userState() >= 0)
+        return p.userState();
+    if (BlockInfo *i = dynamic_cast<BlockInfo*>(p.userData()))
+        return i->state_out;
+    return BlockInfo::s_normal;
+}
+
+BlockInfo *BlockInfo::of(QTextBlock b) {
+    BlockInfo *i = dynamic_cast<BlockInfo*>(b.userData());
+    if (!i) {
+        i = new BlockInfo;
+        i->revision = i->length = i->state_in = -1;
+        i->state_out = s_normal;
+        b.setUserData(i);
+    }
+    int state = state_before(b);
+    if (i->revision != b.revision() || i->length != b.length() || i->state_in != state) {
+        i->state_in = state;
+        i->scan(b.text());
+        i->revision = b.revision();
+        i->length = b.length();
+    }
+    return i;
+}
+
+void BlockInfo::scan(const QString &text) {
+    state_out = lex(text, state_in, tokens);
+
+    brackets.clear();
+    int forward[kinds];
+    for (int k = 0; k < kinds; ++k)
+        forward[k] = min_prefix[k] = min_suffix[k] = 0;
+
+    const ushort *t = text.utf16();
+    foreach (const token &x, tokens) {
+        bool open;
+        int k = x.type == t_punct ? kind(t[x.offset], open) : -1;
+        if (k >= 0) {
+            bracket y = { x.offset, t[x.offset] };
+            brackets.append(y);
+            forward[k] += open ? 1 : -1;
+            min_prefix[k] = qMin(min_prefix[k], forward[k]);
+        }
+    }
+
+    int backward[kinds] = { 0, 0, 0 };
+    for (int x = brackets.size() - 1; x >= 0; --x) {
+        bool open;
+        int k = kind(brackets[x].ch, open);
+        backward[k] += open ? -1 : 1;
+        min_suffix[k] = qMin(min_suffix[k], backward[k]);
+    }
+
+    for (int k = 0; k < kinds; ++k)
+        delta[k] = forward[k];
+}
+
+const BlockInfo::token *BlockInfo::token_at(int offset) const {
+    int l = 0, h = tokens.size();
+    while (l < h) {
+        int m = (l + h) / 2;
+        if (tokens[m].offset + tokens[m].length <= offset)
+            l = m + 1;
+        else
+            h = m;
+    }
+    return l < tokens.size() && tokens[l].contains(offset) ? &tokens[l] : 0;
+}
+
+const BlockInfo::bracket *BlockInfo::bracket_at(int offset) const {
+    int l = 0, h = brackets.size();
+    while (l < h) {
+        int m = (l + h) / 2;
+        if (brackets[m].offset < offset)
+            l = m + 1;
+        else
+            h = m;
+    }
+    return l < brackets.size() && brackets[l].offset == offset ? &brackets[l] : 0;
+}
+
+/** end (past closing quote) of quoted text from position after opening quote
+ *  handles doubled quotes and backslash escapes, -1 if it continues on next line
+ */
+static int quoted_end(const QString &text, int from, QChar q) {
+    for (int j = from; j < text.length(); )
+        if (text[j] == '\\')
+            j += 2;
+        else if (text[j] == q) {
+            if (j + 1 < text.length() && text[j + 1] == q)
+                j += 2;
+            else
+                return j + 1;
+        }
+        else
+            ++j;
+    return -1;
+}
+
+static bool is_punct(QChar c) {
+    return c.unicode() < 128 && c.unicode() && strchr("()[]{},|!;", c.toLatin1());
+}
+static bool is_symbol(QChar c) {
+    return c.unicode() < 128 && c.unicode() && strchr("+-*/\\^<>=~:.?@#&$", c.toLatin1());
+}
+static bool is_alnum(QChar c) {
+    return c.isLetterOrNumber() || c == '_';
+}
+
+int BlockInfo::lex(const QString &text, int state, QVector<token> &tokens) {
+    tokens.clear();
+    int n = text.length(), i = 0;
+
+    struct adder {
+        QVector<token> &tokens;
+        void operator()(int offset, int length, int type) {
+            token x = { offset, length, type };
+            tokens.append(x);
+        }
+    } add = { tokens };
+
+    // continue a comment or quoted text left open by previous block
+    if (state == s_comment) {
+        int e = text.indexOf("*/");
+        if (e < 0) {
+            add(0, n, t_comment);
+            return s_comment;
+        }
+        add(0, i = e + 2, t_comment);
+    }
+    else if (state != s_normal) {
+        QChar q = state == s_quoted ? '\'' : state == s_string ? '"' : '`';
+        int type = state == s_quoted ? t_quoted : t_string;
+        int e = quoted_end(text, 0, q);
+        if (e < 0) {
+            add(0, n, type);
+            return state;
+        }
+        add(0, i = e, type);
+    }
+
+    while (i < n) {
+        QChar c = text[i];
+        int s = i;
+
+        if (c.isSpace())
+            ++i;
+        else if (c == '%') {
+            add(i, n - i, t_comment);
+            break;
+        }
+        else if (c == '/' && i + 1 < n && text[i + 1] == '*') {
+            int e = text.indexOf("*/", i + 2);
+            if (e < 0) {
+                add(i, n - i, t_comment);
+                return s_comment;
+            }
+            add(i, e + 2 - i, t_comment);
+            i = e + 2;
+        }
+        else if (c == '\'' || c == '"' || c == '`') {
+            int type = c == '\'' ? t_quoted : t_string;
+            int e = quoted_end(text, i + 1, c);
+            if (e < 0) {
+                add(i, n - i, type);
+                return c == '\'' ? s_quoted : c == '"' ? s_string : s_backquote;
+            }
+            add(i, e - i, type);
+            i = e;
+        }
+        else if (c.isDigit()) {
+            if (c == '0' && i + 2 < n && text[i + 1] == '\'') {
+                // character code: 0'c 0'\n 0''
+                i += 2;
+                if (text[i] == '\\' || (text[i] == '\'' && i + 1 < n && text[i + 1] == '\''))
+                    ++i;
+                i = qMin(i + 1, n);
+            }
+            else {
+                while (i < n && is_alnum(text[i]))
+                    ++i;
+                if (i + 1 < n && text[i] == '.' && text[i + 1].isDigit())
+                    for (++i; i < n && is_alnum(text[i]); )
+                        ++i;
+            }
+            add(s, i - s, t_number);
+        }
+        else if (c.isLetter() || c == '_') {
+            while (i < n && is_alnum(text[i]))
+                ++i;
+            add(s, i - s, c.isUpper() || c == '_' ? t_variable : t_atom);
+        }
+        else if (c == '.' && (i + 1 == n || text[i + 1].isSpace() || text[i + 1] == '%')) {
+            add(i, 1, t_fullstop);
+            ++i;
+        }
+        else if (is_punct(c)) {
+            add(i, 1, t_punct);
+            ++i;
+        }
+        else if (is_symbol(c)) {
+            while (i < n && is_symbol(text[i]))
+                ++i;
+            add(s, i - s, t_symbol);
+        }
+        else
+            ++i;
+    }
+
+    return s_normal;
+}
 
 ParenMatching::ParenMatching(QTextCursor c)
     : onOpen(false)
 {
     int save_p = c.position();
-    QChar p = cc(c), q;
-    QTextCursor::MoveOperation d = c.NoMove;
-
-    if (p == '(') q = ')', d = c.Right, onOpen = true;
-    if (p == '[') q = ']', d = c.Right, onOpen = true;
-    if (p == '{') q = '}', d = c.Right, onOpen = true;
-
-    if (d == c.NoMove && c.movePosition(c.Left)) {
-        p = cc(c);
-        if (p == ')') q = '(', d = c.Left;
-        if (p == ']') q = '[', d = c.Left;
-        if (p == '}') q = '{', d = c.Left;
+    QTextBlock b = c.block();
+    int o = save_p - b.position();
+
+    // only brackets outside quotes and comments
+    BlockInfo *info = BlockInfo::of(b);
+    const BlockInfo::bracket *at = info->bracket_at(o);
+
+    bool open = false;
+    int k = at ? BlockInfo::kind(at->ch, open) : -1;
+    if (k >= 0 && open)
+        onOpen = true;
+    else {
+        at = o > 0 ? info->bracket_at(o - 1) : 0;
+        k = at ? BlockInfo::kind(at->ch, open) : -1;
+        if (k >= 0 && open)
+            k = -1;
+        --o;    // on the closing one
     }
+    if (k < 0)
+        return;
 
-    if (d != c.NoMove) {
-        int n = 0;
-        while (c.movePosition(d)) {
-            QChar z = cc(c);
-            if (z == q) {
-                if (n-- == 0) {
-                    if (onOpen)
-                        positions = range(save_p, c.position());
-                    else
-                        positions = range(c.position(), save_p - 1);
-                    break;
+    // n counts brackets of same kind still to be balanced
+    int n = 0;
+    if (onOpen) {
+        for (int start = o; b.isValid(); b = b.next(), start = -1) {
+            BlockInfo *i = BlockInfo::of(b);
+            if (start < 0 && n + i->min_prefix[k] >= 0) {
+                n += i->delta[k];
+                continue;
+            }
+            foreach (const BlockInfo::bracket &x, i->brackets) {
+                bool xo;
+                if (x.offset <= start || BlockInfo::kind(x.ch, xo) != k)
+                    continue;
+                if (xo)
+                    ++n;
+                else if (n-- == 0) {
+                    positions = range(save_p, b.position() + x.offset);
+                    return;
+                }
+            }
+        }
+    }
+    else {
+        for (int start = o; b.isValid(); b = b.previous(), start = -1) {
+            BlockInfo *i = BlockInfo::of(b);
+            if (start < 0 && n + i->min_suffix[k] >= 0) {
+                n -= i->delta[k];
+                continue;
+            }
+            for (int x = i->brackets.size() - 1; x >= 0; --x) {
+                const BlockInfo::bracket &y = i->brackets[x];
+                bool xo;
+                if ((start >= 0 && y.offset >= start) || BlockInfo::kind(y.ch, xo) != k)
+                    continue;
+                if (!xo)
+                    ++n;
+                else if (n-- == 0) {
+                    positions = range(b.position() + y.offset, save_p - 1);
+                    return;
                 }
             }
-            else if (z == p)
-                ++n;
         }
     }
-
-    c.setPosition(save_p);
 }
 
 /** utility: fetch text in range from a text document
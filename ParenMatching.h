@@ -26,11 +26,71 @@
 #include "pqConsole_global.h"
 
 #include <QObject>
+#include <QVector>
+#include <QTextBlock>
 #include <QTextCursor>
 #include <QTextDocument>
 #include <QTextCharFormat>
 
+/** per block cache, valid while block revision and entry lexer state are unchanged:
+ *  Prolog tokens, bracket offsets (outside quotes and comments),
+ *  and for each bracket kind the nesting summary used to skip blocks
+ */
+struct PQCONSOLESHARED_EXPORT BlockInfo : public QTextBlockUserData {
+
+    /** lexer state at block boundary, kept in QTextBlock::userState() by PrologHighlighter */
+    enum { s_normal, s_comment, s_quoted, s_string, s_backquote };
+
+    enum token_type { t_atom, t_variable, t_number, t_quoted, t_string, t_comment, t_punct, t_symbol, t_fullstop };
+    struct token {
+        int offset, length;
+        int type;
+        bool contains(int o) const { return offset <= o && o < offset + length; }
+    };
+    QVector<token> tokens;
+
+    /** lexer state at end of block */
+    int state_out;
+
+    struct bracket {
+        int offset;
+        ushort ch;
+    };
+    QVector<bracket> brackets;
+
+    /** (), [], {} */
+    enum { kinds = 3 };
+
+    int delta[kinds];       // opens - closes
+    int min_prefix[kinds];  // lowest opens - closes, scanning forward: <= 0
+    int min_suffix[kinds];  // lowest closes - opens, scanning backward: <= 0
+
+    /** up to date info of block, scanned again only if edited */
+    static BlockInfo *of(QTextBlock b);
+
+    /** bracket kind, -1 if not a bracket */
+    static int kind(ushort c, bool &open);
+
+    /** token covering offset, 0 if none */
+    const token *token_at(int offset) const;
+
+    /** bracket at offset, 0 if none */
+    const bracket *bracket_at(int offset) const;
+
+    /** tokenize a line of Prolog text starting in state, return state at end */
+    static int lex(const QString &text, int state, QVector<token> &tokens);
+
+private:
+
+    int revision;
+    int length;
+    int state_in;
+    void scan(const QString &text);
+};
+
 /** get open/close parenthesis matching from QTextCursor current position
+ *  visits only brackets: blocks not containing the match are skipped by their BlockInfo summary
+ *  brackets inside quoted text or comments are ignored
  */
 class PQCONSOLESHARED_EXPORT ParenMatching : public QObject
 {
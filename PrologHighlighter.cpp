@@ -0,0 +1,75 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "PrologHighlighter.h"
+#include <QTextDocument>
+
+PrologHighlighter::PrologHighlighter(QTextDocument *doc) :
+    QSyntaxHighlighter(doc), input_start(doc), enabled(false)
+{
+    formats[BlockInfo::t_variable].setForeground(Qt::darkRed);
+    formats[BlockInfo::t_number].setForeground(Qt::darkBlue);
+    formats[BlockInfo::t_quoted].setForeground(Qt::darkMagenta);
+    formats[BlockInfo::t_string].setForeground(Qt::darkGreen);
+    formats[BlockInfo::t_comment].setForeground(Qt::gray);
+    formats[BlockInfo::t_comment].setFontItalic(true);
+    formats[BlockInfo::t_fullstop].setFontWeight(QFont::Bold);
+}
+
+/** move the boundary between output and editable text
+ *  only blocks from the new input start will be colored on their next change
+ */
+void PrologHighlighter::set_input_start(int position) {
+    enabled = position >= 0;
+    if (enabled)
+        input_start.setPosition(position);
+}
+
+void PrologHighlighter::apply(const QVector<BlockInfo::token> &tokens, int offset) {
+    foreach (const BlockInfo::token &t, tokens)
+        if (formats[t.type].propertyCount())
+            setFormat(t.offset + offset, t.length, formats[t.type]);
+}
+
+void PrologHighlighter::highlightBlock(const QString &text) {
+    QTextBlock b = currentBlock();
+    int start = input_start.position() - b.position();
+
+    if (!enabled || start > text.length()) {
+        // engine output
+        setCurrentBlockState(BlockInfo::s_normal);
+        return;
+    }
+
+    if (start > 0) {
+        // prompt line: lex only after the prompt
+        QVector<BlockInfo::token> tokens;
+        setCurrentBlockState(BlockInfo::lex(text.mid(start), BlockInfo::s_normal, tokens));
+        apply(tokens, start);
+        return;
+    }
+
+    // cached tokens, lexed again only if block edited or entry state changed
+    BlockInfo *i = BlockInfo::of(b);
+    apply(i->tokens, 0);
+    setCurrentBlockState(i->state_out);
+}
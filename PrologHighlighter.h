@@ -0,0 +1,61 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef PROLOGHIGHLIGHTER_H
+#define PROLOGHIGHLIGHTER_H
+
+#include "pqConsole_global.h"
+#include "ParenMatching.h"
+
+#include <QSyntaxHighlighter>
+#include <QTextCursor>
+
+/** incremental Prolog syntax coloring of the console input area
+ *  lexer state at end of each block (open comment or quoted text) is kept in userState,
+ *  so QSyntaxHighlighter revisits only edited blocks, and following ones while the state changes
+ *  tokens are cached in BlockInfo, shared with ParenMatching and Completion
+ */
+class PQCONSOLESHARED_EXPORT PrologHighlighter : public QSyntaxHighlighter
+{
+    Q_OBJECT
+public:
+
+    explicit PrologHighlighter(QTextDocument *doc);
+
+    /** text before position is engine output, left uncolored: -1 while the engine is running */
+    void set_input_start(int position);
+
+protected:
+
+    virtual void highlightBlock(const QString &text);
+
+private:
+
+    /** shifts with document edits, as output is inserted before the prompt */
+    QTextCursor input_start;
+    bool enabled;
+
+    QTextCharFormat formats[BlockInfo::t_fullstop + 1];
+    void apply(const QVector<BlockInfo::token> &tokens, int offset);
+};
+
+#endif // PROLOGHIGHLIGHTER_H
@@ -25,28 +25,51 @@
 #include "SwiPrologEngine.h"
 #include "PREDICATE.h"
 
-#include "ConsoleEdit.h"
 #include "do_events.h"
+#include "Watchdog.h"
 
 #include <QtDebug>
-#include <QApplication>
+#include <QCoreApplication>
 #include <signal.h>
 #include <QTimer>
 #include <QFile>
+#include <QDir>
+#include <QSaveFile>
+#include <QLockFile>
+#include <QFileInfo>
+#include <QResource>
+#include <QStandardPaths>
+#include <QCryptographicHash>
 
 /** singleton handling - process main engine
  */
 SwiPrologEngine *SwiPrologEngine::spe;
 
+/** contention accounting */
+static sync_point engine_sync_point("SwiPrologEngine::sync");
+static sync_point in_thread_point("SwiPrologEngine::in_thread startup");
+
+/** readiness of main engine, set after PL_initialise
+ */
+static QMutex ready_sync;
+static QWaitCondition ready_cond;
+static bool ready;
+static QList<pfunc> ready_hooks;
+static QList<pfunc> halt_hooks;         // syncronized by ready_sync
+
 /** enforce singleton handling
  */
-SwiPrologEngine::SwiPrologEngine(ConsoleEdit *target, QObject *parent)
+SwiPrologEngine::SwiPrologEngine(ConsoleTarget *target, QObject *parent)
     : QThread(parent),
       FlushOutputEvents(target),
-      argc(-1)
+      argc(-1),
+      sync(&engine_sync_point)
 {
     Q_ASSERT(spe == 0);
     spe = this;
+
+    // emitted from engine thread, served in GUI thread
+    connect(this, SIGNAL(engine_initialized()), this, SLOT(awake()));
 }
 
 /** enforce proper termination sequence
@@ -68,13 +91,14 @@ void SwiPrologEngine::start(int argc, char **argv) {
     this->argv = new char*[this->argc = argc];
     for (int a = 0; a < argc; ++a)
         strcpy(this->argv[a] = new char[strlen(argv[a]) + 1], argv[a]);
+    Watchdog::setup();
     QThread::start();
 }
 
 /** from console front end: user - or a equivalent actor - has input s
  */
 void SwiPrologEngine::user_input(QString s) {
-    QMutexLocker lk(&sync);
+    sync_locker lk(&sync);
     buffer = s.toUtf8();
 }
 
@@ -95,7 +119,9 @@ ssize_t SwiPrologEngine::_read_(char *buf, size_t bufsize) {
 
     for ( ; ; ) {
 
-        {   QMutexLocker lk(&sync);
+        Watchdog::beat("main engine");
+
+        {   sync_locker lk(&sync);
 
             if (!spe) // terminated
                 return 0;
@@ -111,8 +137,8 @@ ssize_t SwiPrologEngine::_read_(char *buf, size_t bufsize) {
                 return l;
             }
 
-            if (target->status == ConsoleEdit::eof) {
-                target->status = ConsoleEdit::running;
+            if (target->status == ConsoleTarget::eof) {
+                target->status = ConsoleTarget::running;
                 return 0;
             }
         }
@@ -164,7 +190,7 @@ ssize_t SwiPrologEngine::_write_(void *handle, char *buf, size_t bufsize) {
     Q_UNUSED(handle);
     if (spe) {   // not terminated?
         emit spe->user_output(QString::fromUtf8(buf, bufsize));
-        if (spe->target->status == ConsoleEdit::running)
+        if (spe->target->status == ConsoleTarget::running)
             spe->flush();
     }
     return bufsize;
@@ -189,6 +215,14 @@ int SwiPrologEngine::halt_engine(int status, void*data)
 { Q_UNUSED(data);
 
   qDebug() << "halt_engine" << status;
+  QList<pfunc> hooks;
+  { QMutexLocker lk(&ready_sync);
+    hooks.swap(halt_hooks);
+  }
+  foreach (pfunc f, hooks)
+    f();
+  Watchdog::shutdown();
+  sync_point::dump();
   QCoreApplication::quit();
   msleep(5000);
 
@@ -228,10 +262,21 @@ void SwiPrologEngine::run() {
     PL_exit_hook(halt_engine, NULL);
 
     PL_initialise(argc, argv);
+    startup_timeline::mark("PL_initialise");
 
     // use as initialized flag
     argc = 0;
 
+    QList<pfunc> hooks;
+    {   QMutexLocker lk(&ready_sync);
+        ready = true;
+        ready_cond.wakeAll();
+        hooks.swap(ready_hooks);
+    }
+    foreach (pfunc f, hooks)
+        f();
+    emit engine_initialized();
+
     /*
     PL_toplevel();
     // keep arguments valid while running
@@ -252,7 +297,7 @@ void SwiPrologEngine::run() {
 /** push an unnamed query, thus unlocking the execution polling loop
  */
 void SwiPrologEngine::query_run(QString text) {
-    QMutexLocker lk(&sync);
+    sync_locker lk(&sync);
 #if !defined(_MSC_VER) || _MSC_VER >= 1800
     queries.append(query {false, "", text});
 #else
@@ -263,7 +308,7 @@ void SwiPrologEngine::query_run(QString text) {
 /** push a named query, thus unlocking the execution polling loop
  */
 void SwiPrologEngine::query_run(QString module, QString text) {
-    QMutexLocker lk(&sync);
+    sync_locker lk(&sync);
 #if !defined(_MSC_VER) || _MSC_VER >= 1800
     queries.append(query {false, module, text});
 #else
@@ -272,22 +317,75 @@ void SwiPrologEngine::query_run(QString module, QString text) {
 }
 
 /** allows to run a delayed script from resource at startup
+ *  served as soon as the engine is ready
  */
 void SwiPrologEngine::script_run(QString name, QString text) {
+    {   sync_locker lk(&sync);
 #if !defined(_MSC_VER) || _MSC_VER >= 1800
-    queries.append(query {true, name, text});
+        scripts.append(query {true, name, text});
 #else
-    queries.append(query(true, name, text));
+        scripts.append(query(true, name, text));
 #endif
-    QTimer::singleShot(100, this, SLOT(awake()));
+    }
+    if (is_ready())
+        QTimer::singleShot(0, this, SLOT(awake()));
 }
 void SwiPrologEngine::awake() {
-    Q_ASSERT(queries.count() == 1);
-    query p = queries.takeFirst();
-    Q_ASSERT(!p.name.isEmpty());
-    in_thread I;
-    if (!I.named_load(p.name, p.text))
-        qDebug() << "awake failed";
+    QList<query> l;
+    {   sync_locker lk(&sync);
+        l.swap(scripts);
+    }
+    if (!l.isEmpty()) {
+        in_thread I;
+        foreach (query p, l) {
+            Q_ASSERT(p.is_script && !p.name.isEmpty());
+            if (!I.named_load(p.name, p.text))
+                qDebug() << "awake failed" << p.name;
+        }
+    }
+}
+
+/** block until PL_initialise completed
+ */
+bool SwiPrologEngine::wait_ready(int timeout_ms) {
+    QMutexLocker lk(&ready_sync);
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!ready) {
+        if (timeout_ms < 0)
+            ready_cond.wait(&ready_sync);
+        else {
+            qint64 left = timeout_ms - elapsed.elapsed();
+            if (left <= 0)
+                return false;
+            ready_cond.wait(&ready_sync, ulong(left));
+        }
+    }
+    return true;
+}
+
+bool SwiPrologEngine::is_ready() {
+    QMutexLocker lk(&ready_sync);
+    return ready;
+}
+
+/** register a warm up function
+ */
+void SwiPrologEngine::on_ready(pfunc f) {
+    {   QMutexLocker lk(&ready_sync);
+        if (!ready) {
+            ready_hooks.append(f);
+            return;
+        }
+    }
+    f();
+}
+
+/** register a shutdown function
+ */
+void SwiPrologEngine::on_halt(pfunc f) {
+    QMutexLocker lk(&ready_sync);
+    halt_hooks.append(f);
 }
 
 /** Create a Prolog thread for the GUI thread, so we can call Prolog
@@ -298,12 +396,11 @@ void SwiPrologEngine::awake() {
 SwiPrologEngine::in_thread::in_thread()
     : frame(0)
 {
-    while (!spe)
-        msleep(100);
-    while (!spe->isRunning())
-        msleep(100);
-    while (spe->argc)
-        msleep(100);
+    {   sync_wait w(in_thread_point);
+        if (!is_ready())
+            w.blocked();
+        wait_ready();
+    }
 
     PL_thread_attr_t attr;
     memset(&attr, 0, sizeof(attr));
@@ -329,9 +426,8 @@ SwiPrologEngine::in_thread::~in_thread() {
 
 structure1(stream)
 structure1(silent)
+structure1(qcompile)
 
-predicate2(atom_codes)
-predicate2(open_chars_stream)
 predicate2(load_files)
 predicate1(current_module)
 predicate1(close)
@@ -339,33 +435,41 @@ predicate1(close)
 /** run script <t>, named <n> in current thread
  */
 bool SwiPrologEngine::in_thread::named_load(QString n, QString t, bool silent_yn) {
+    return named_load(n, t.toUtf8(), silent_yn);
+}
+
+/** run UTF-8 script <t>, named <n> in current thread
+ *  the stream reads directly from t memory: no intermediate atom or codes list
+ */
+bool SwiPrologEngine::in_thread::named_load(QString n, const QByteArray &t, bool silent_yn) {
+    IOSTREAM *in = Sopen_string(0, const_cast<char*>(t.constData()), size_t(t.size()), "r");
+    if (!in)
+        return false;
+    in->encoding = ENC_UTF8;
+
     try {
-        PlTerm cs, s, opts;
-#if 1
-        if (    atom_codes(A(t), cs) &&
-                open_chars_stream(cs, s)) {
-            PlTail l(opts);
-            l.append(stream(s));
-            if (silent_yn)
-                l.append(silent(A("true")));
-            l.close();
-            bool rc = load_files(A(n), opts);
-            close(s);
-            return rc;
+        PlTerm s, opts;
+        if (!PL_unify_stream(s, in)) {
+            Sclose(in);
+            return false;
         }
-#else
-        if (    PlCall("atom_codes", PlTermv(A(t), cs)) &&
-                PlCall("open_chars_stream", PlTermv(cs, s))) {
-            PlTail l(opts);
-            l.append(PlCompound("stream", PlTermv(s)));
-            if (silent_yn)
-                l.append(PlCompound("silent", PlTermv(A("true"))));
-            l.close();
-            bool rc = load_files(A(n), opts);
+
+        PlTail l(opts);
+        l.append(stream(s));
+        if (silent_yn)
+            l.append(silent(FA("true")));
+        l.close();
+
+        bool rc;
+        try {
+            rc = load_files(A(n), opts);
+        }
+        catch(PlException) {
             close(s);
-            return rc;
+            throw;
         }
-#endif
+        close(s);
+        return rc;
     }
     catch(PlException ex) {
         qDebug() << t2w(ex);
@@ -381,7 +485,7 @@ bool SwiPrologEngine::in_thread::inline_module(QString module, QString  code, bo
     //if (!PlCall("current_module", PlTermv(A(module)))) {
     if (!current_module(A(module))) {
         qDebug() << "loading module snippet" << module;
-        return named_load(module, code, silent);
+        return cached_load(module, module, code.toUtf8(), silent);
     }
     qDebug() << "module available" << module;
     return true;
@@ -394,17 +498,117 @@ bool SwiPrologEngine::in_thread::resource_module(QString module, QString locatio
     if (!current_module(A(module))) {
         qDebug() << "loading resource_module" << module << "from" << location;
         QString path = location + "/" + module + ".pl";
+
+        // uncompressed resource: share its memory, without copying
+        QResource res(path);
+        if (res.isValid() && !res.isCompressed())
+            return cached_load(module, path,
+                QByteArray::fromRawData(reinterpret_cast<const char*>(res.data()), int(res.size())), silent);
+
         QFile file(path);
-        if (!file.open(file.ReadOnly | file.Text)) {
+        if (!file.open(file.ReadOnly)) {
             qDebug() << "path not found" << path;
             return false;
         }
-        return named_load(path, file.readAll(), silent);
+        return cached_load(module, path, file.readAll(), silent);
     }
     qDebug() << "module available" << module;
     return true;
 }
 
+/** per user directory of compiled modules, empty if not available
+ */
+static QString qlf_cache_dir() {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (dir.isEmpty() || !QDir().mkpath(dir + "/qlf"))
+        return QString();
+    return dir + "/qlf";
+}
+
+/** readable path for the cached copy of source <name>: resource path, or module name
+ */
+static QString qlf_source_path(QString name) {
+    if (name.startsWith(":/"))
+        name = name.mid(2);
+    if (!name.endsWith(".pl"))
+        name += ".pl";
+    return name;
+}
+
+structure2(cached_source)
+predicate1(assertz)
+
+/** compile once - when content or SWI-Prolog version change - then load the .qlf
+ *  SWI-Prolog records the cached copy as the source file: the entry directory keeps
+ *  the original name (<hash>/<resource path>), and pqConsole:cached_source(File, Name)
+ *  maps it back to the resource or module name.
+ *  The image is published by rename when complete, and compile and load
+ *  are serialized between processes by a lock file: when busy, source is loaded.
+ */
+bool SwiPrologEngine::in_thread::cached_load(QString module, QString name, const QByteArray &script, bool silent_yn) {
+    QString dir = qlf_cache_dir();
+    if (!dir.isEmpty()) {
+        QCryptographicHash h(QCryptographicHash::Sha1);
+        h.addData(name.toUtf8());
+        h.addData(script);
+        h.addData(QByteArray::number(qlonglong(PL_query(PL_QUERY_VERSION))));
+        QString entry = dir + "/" + h.result().toHex();
+
+        QString pl = entry + "/" + qlf_source_path(name);
+        // qcompile writes <source>.qlf: published by rename to the image name once complete
+        QString qlf = pl.left(pl.length() - 3) + ".qlf",
+                image = pl.left(pl.length() - 3) + ".image.qlf";
+
+        // another process could be writing the image: don't wait for it, as
+        // usually called from GUI thread at startup, load from source instead
+        QLockFile lock(entry + ".lock");
+        lock.setStaleLockTime(60000);
+        if (lock.tryLock(100) && QDir().mkpath(QFileInfo(pl).path())) {
+            PlCompound mapping(":", V(FA("pqConsole"), cached_source(A(pl), A(name))));
+            bool compiling = false;
+            try {
+                PlTerm opts;
+                PlTail l(opts);
+                if (silent_yn)
+                    l.append(silent(FA("true")));
+
+                if (QFile::exists(image)) {
+                    l.close();
+                    if (load_files(A(image), opts))
+                        return assertz(mapping);
+                }
+                else {
+                    QSaveFile f(pl);
+                    if (f.open(f.WriteOnly) && f.write(script) >= 0 && f.commit()) {
+                        l.append(qcompile(FA("always")));
+                        l.close();
+                        compiling = true;
+                        if (load_files(A(pl), opts)) {
+                            QFile::remove(image);
+                            QFile::rename(qlf, image);
+                            return assertz(mapping);
+                        }
+                    }
+                }
+            }
+            catch(PlException ex) {
+                qDebug() << "cached_load" << name << t2w(ex);
+            }
+
+            // compiled from source: errors already reported, don't compile again
+            QFile::remove(qlf);
+            if (compiling)
+                return false;
+
+            // invalid image: rebuild next time
+            QFile::remove(image);
+            if (current_module(A(module)))
+                return true;
+        }
+    }
+    return named_load(name, script, silent_yn);
+}
+
 /** handle application quit request in thread that started PL_toplevel
  *  logic moved here from pqMainWindow
  */
@@ -31,21 +31,19 @@
 #include <QVariant>
 #include <QStringList>
 #include <QWaitCondition>
-#include <functional>
-
-/** 1. attempt to run generic code inter threads */
-typedef std::function<void()> pfunc;
 
+#include "GuiTaskQueue.h"
+#include "SyncMetrics.h"
 #include "FlushOutputEvents.h"
 #include "pqConsole_global.h"
 
 /** interface IO running SWI Prolog engine in background
  */
-class PQCONSOLESHARED_EXPORT SwiPrologEngine : public QThread, public FlushOutputEvents {
+class PQCONSOLECORE_EXPORT SwiPrologEngine : public QThread, public FlushOutputEvents {
     Q_OBJECT
 public:
 
-    explicit SwiPrologEngine(ConsoleEdit *target, QObject *parent = 0);
+    explicit SwiPrologEngine(ConsoleTarget *target, QObject *parent = 0);
     ~SwiPrologEngine();
 
     /** main console startup point */
@@ -59,19 +57,27 @@ public:
     void script_run(QString name, QString text);
 
     /** start/stop a Prolog engine in thread - use for syncronized GUI */
-    struct PQCONSOLESHARED_EXPORT in_thread {
+    struct PQCONSOLECORE_EXPORT in_thread {
         in_thread();
         ~in_thread();
 
         /** run named script in current thread */
         bool named_load(QString name, QString script, bool silent = true);
 
+        /** run named UTF-8 script in current thread, reading directly from its memory */
+        bool named_load(QString name, const QByteArray &script, bool silent = true);
+
         /** if module not yet loaded, load code (i.e. assumes it starts with :-module(module)) */
         bool inline_module(QString Module, QString code, bool silent = true);
 
         /** if not yet loaded, parse module code from resource */
         bool resource_module(QString module, QString location = ":/prolog", bool silent = true);
 
+        /** load module code through a compiled (.qlf) image, cached per user
+         *  keyed by content and SWI-Prolog version: fall back to named_load
+         */
+        bool cached_load(QString module, QString name, const QByteArray &script, bool silent = true);
+
     private:
         PlFrame *frame;
     };
@@ -79,6 +85,22 @@ public:
     /** handle application quit request in thread that started PL_toplevel */
     static bool quit_request();
 
+    /** block until PL_initialise completed - forever when timeout_ms < 0 - false on timeout */
+    static bool wait_ready(int timeout_ms = -1);
+
+    /** true after PL_initialise completed */
+    static bool is_ready();
+
+    /** register f to be run in engine thread just after PL_initialise
+     *  (immediately, in calling thread, if already initialized)
+     */
+    static void on_ready(pfunc f);
+
+    /** register f to be run by halt_engine, before the application quits
+     *  (i.e. to stop threads owning a Prolog engine)
+     */
+    static void on_halt(pfunc f);
+
     /** utility: make public */
     static void msleep(unsigned long n) { QThread::msleep(n); }
 
@@ -102,6 +124,9 @@ signals:
     /** signal exception */
     void query_exception(QString query, QString message);
 
+    /** notify PL_initialise completed */
+    void engine_initialized();
+
 public slots:
 
     /** store string in buffer */
@@ -124,9 +149,10 @@ protected:
            is_script(is_script), name(name), text(text) {}
     };
 
-    QMutex sync;
+    sync_mutex sync;
     QByteArray buffer;      // syncronized !
     QList<query> queries;   // syncronized !
+    QList<query> scripts;   // syncronized ! run in GUI thread when ready
 
     void serve_query(query q);
 
@@ -140,6 +166,7 @@ protected:
 
 private slots:
 
+    /** run scripts queued before engine was ready */
     void awake();
 
 private:
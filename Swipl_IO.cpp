@@ -22,12 +22,16 @@
 
 #include "Swipl_IO.h"
 #include "PREDICATE.h"
-#include "pqMainWindow.h"
+#include "Watchdog.h"
 #include <QDebug>
 #include <QTime>
 
+/** contention accounting, shared by all instances */
+static sync_point io_sync_point("Swipl_IO::sync");
+
 Swipl_IO::Swipl_IO(QObject *parent) :
-    QObject(parent)
+    QObject(parent),
+    sync(&io_sync_point)
 {
 }
 
@@ -86,7 +90,8 @@ ssize_t Swipl_IO::_read_(char *buf, size_t bufsize) {
 
     // handle setup interthread and termination
     for ( ; ; ) {
-        {   QMutexLocker lk(&sync);
+        Watchdog::beat("console engine");
+        {   sync_locker lk(&sync);
             if (target) {
                 if (!target->thids.contains(thid)) {
                     target->add_thread(thid);
@@ -111,11 +116,13 @@ ssize_t Swipl_IO::_read_(char *buf, size_t bufsize) {
 
     for ( ; ; ) {
 
-        {   QMutexLocker lk(&sync);
+        Watchdog::beat("console engine");
+
+        {   sync_locker lk(&sync);
 
             if (!query.isEmpty()) {
                 try {
-                    int rc = PlCall(query.toStdWString().data());
+                    int rc = PlCall(WCS(query));
                     qDebug() << "PlCall" << query << rc;
                 }
                 catch(PlException e) {
@@ -133,8 +140,8 @@ ssize_t Swipl_IO::_read_(char *buf, size_t bufsize) {
                 return l;
             }
 
-            if (target->status == ConsoleEdit::eof) {
-	        target->status = ConsoleEdit::running;
+            if (target->status == ConsoleTarget::eof) {
+	        target->status = ConsoleTarget::running;
                 return 0;
 	    }
         }
@@ -149,12 +156,12 @@ ssize_t Swipl_IO::_read_(char *buf, size_t bufsize) {
 /** syncronized storage of user input from console front end
  */
 void Swipl_IO::user_input(QString s) {
-    QMutexLocker lk(&sync);
+    sync_locker lk(&sync);
     buffer = s.toUtf8();
 }
 
 void Swipl_IO::take_input(QString cmd) {
-    QMutexLocker lk(&sync);
+    sync_locker lk(&sync);
     buffer = cmd.toUtf8();
 }
 
@@ -163,14 +170,14 @@ void Swipl_IO::eng_at_exit(void *p) {
     emit e->sig_eng_at_exit();
 }
 
-void Swipl_IO::attached(ConsoleEdit *c) {
-    QMutexLocker lk(&sync);
+void Swipl_IO::attached(ConsoleTarget *c) {
+    sync_locker lk(&sync);
     Q_ASSERT(target == 0);
     target = c;
 }
 
 void Swipl_IO::query_run(QString newquery) {
-    QMutexLocker lk(&sync);
+    sync_locker lk(&sync);
     Q_ASSERT(query.isEmpty());
     query = newquery;
 }
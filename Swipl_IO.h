@@ -23,13 +23,13 @@
 #ifndef SWIPL_IO_H
 #define SWIPL_IO_H
 
-#include "ConsoleEdit.h"
+#include "ConsoleTarget.h"
 #include "SwiPrologEngine.h"
 
 /** This class keeps the essential elements to get console behaviour.
  *  It's obtained from [SwiPrologEngine](@ref SwiPrologEngine), but tied to a SWI-Prolog built thread
  */
-class Swipl_IO : public QObject, public FlushOutputEvents {
+class PQCONSOLECORE_EXPORT Swipl_IO : public QObject, public FlushOutputEvents {
     Q_OBJECT
 
 public:
@@ -48,14 +48,14 @@ public:
     void take_input(QString cmd);
 
     /** foreign thread connection completed */
-    void attached(ConsoleEdit *c);
+    void attached(ConsoleTarget *c);
 
     void query_run(QString query);
 
 private:
 
     /** syncronize inter thread access to buffer and query */
-    QMutex sync;
+    sync_mutex sync;
 
     /** output text buffer, made UTF8 */
     QByteArray buffer;
@@ -0,0 +1,161 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define PROLOG_MODULE "pqConsole"
+#include "PREDICATE.h"
+#include "SyncMetrics.h"
+
+#include <QDebug>
+#include <QStringList>
+
+/** list head, zero initialized before any constructor run
+ */
+sync_point *sync_point::first;
+
+/** link in global list (run in static initialization: no locking)
+ */
+sync_point::sync_point(const char *name, bool always)
+    : name(name), always(always), acquisitions(0), contended(0), total_wait_ns(0), max_wait_ns(0), next(first)
+{
+    for (int b = 0; b < buckets; ++b)
+        histogram[b] = 0;
+    first = this;
+}
+
+/** account a completed acquisition
+ */
+void sync_point::record(qint64 wait_ns, bool is_contended) {
+    ++acquisitions;
+    if (!is_contended)
+        return;
+
+    ++contended;
+    total_wait_ns += wait_ns;
+
+    qint64 m = max_wait_ns.load();
+    while (wait_ns > m && !max_wait_ns.compare_exchange_weak(m, wait_ns))
+        ;
+
+    int b = 0;
+    for (qint64 us = wait_ns / 1000; us && b < buckets - 1; us >>= 1)
+        ++b;
+    ++histogram[b];
+}
+
+bool sync_point::enabled() const {
+#ifdef PQCONSOLE_SYNC_METRICS
+    return true;
+#else
+    return always;
+#endif
+}
+
+/** print collected values to debug log
+ */
+void sync_point::dump() {
+    for (sync_point *p = first; p; p = p->next) {
+        if (!p->enabled())
+            continue;
+        QStringList h;
+        for (int b = 0; b < buckets; ++b)
+            h << QString::number(p->histogram[b].load());
+        qDebug() << "sync_metrics" << p->name
+                 << "acquisitions" << p->acquisitions.load()
+                 << "contended" << p->contended.load()
+                 << "total_wait_us" << p->total_wait_ns.load() / 1000
+                 << "max_wait_us" << p->max_wait_ns.load() / 1000
+                 << "histogram" << h.join(" ");
+    }
+}
+
+/** startup events, guarded by timeline_sync
+ */
+static QMutex timeline_sync;
+static startup_timeline::t_events timeline;
+static QElapsedTimer timeline_clock;
+
+/** record first occurrence of event
+ */
+void startup_timeline::mark(const char *event) {
+    QMutexLocker lk(&timeline_sync);
+    for (int e = 0; e < timeline.count(); ++e)
+        if (qstrcmp(timeline[e].first, event) == 0)
+            return;
+    qint64 ms = timeline_clock.elapsed();
+    timeline.append(qMakePair(event, ms));
+    qDebug() << "startup_timeline" << event << ms << "ms";
+}
+
+startup_timeline::t_events startup_timeline::events() {
+    QMutexLocker lk(&timeline_sync);
+    return timeline;
+}
+
+/** start the clock when the library is loaded
+ */
+static struct start_clock {
+    start_clock() {
+        timeline_clock.start();
+        startup_timeline::mark("process start");
+    }
+} start_clock_;
+
+/** startup_timeline(-Events)
+ *  Events is a list of Event-Milliseconds, from process start
+ */
+PREDICATE(startup_timeline, 1) {
+    PlTail l(PL_A1);
+    foreach (auto e, startup_timeline::events())
+        l.append(PlCompound("-", PlTermv(PlAtom(e.first), long(e.second))));
+    l.close();
+    return TRUE;
+}
+
+/** sync_metrics(-Points)
+ *  Points is a list of
+ *    sync(Name, Acquisitions, Contended, TotalWaitUs, MaxWaitUs, Histogram)
+ *  Histogram element N counts waits shorter than 2^N microseconds.
+ *  Without CONFIG+=sync_metrics only points always reported (watchdog stalls) are listed.
+ */
+PREDICATE(sync_metrics, 1) {
+    PlTail l(PL_A1);
+    for (sync_point *p = sync_point::first; p; p = p->next) {
+        if (!p->enabled())
+            continue;
+        PlTerm h;
+        PlTail lh(h);
+        for (int b = 0; b < sync_point::buckets; ++b)
+            lh.append(long(p->histogram[b].load()));
+        lh.close();
+
+        PlTermv a(6);
+        a[0] = PlAtom(p->name);
+        a[1] = long(p->acquisitions.load());
+        a[2] = long(p->contended.load());
+        a[3] = long(p->total_wait_ns.load() / 1000);
+        a[4] = long(p->max_wait_ns.load() / 1000);
+        a[5] = h;
+        l.append(PlCompound("sync", a));
+    }
+    l.close();
+    return TRUE;
+}
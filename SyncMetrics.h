@@ -0,0 +1,138 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef SYNCMETRICS_H
+#define SYNCMETRICS_H
+
+#include "pqConsole_global.h"
+
+#include <QList>
+#include <QPair>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <atomic>
+
+/** counters of a syncronization point (a mutex or a wait)
+ *  enabled at build time: qmake CONFIG+=sync_metrics
+ *  points recorded explicitly (not by sync_mutex/sync_wait) can be always reported
+ *  must be defined static: constructor links it in a global list
+ */
+struct PQCONSOLECORE_EXPORT sync_point {
+
+    explicit sync_point(const char *name, bool always = false);
+
+    /** account a completed acquisition */
+    void record(qint64 wait_ns, bool contended);
+
+    /** histogram of wait times: bucket N counts waits of less than 2^N microseconds */
+    enum { buckets = 24 };
+
+    const char *name;
+    bool always;
+    std::atomic<qint64> acquisitions, contended, total_wait_ns, max_wait_ns;
+    std::atomic<qint64> histogram[buckets];
+
+    /** all registered points */
+    static sync_point *first;
+    sync_point *next;
+
+    /** reported in this build */
+    bool enabled() const;
+
+    /** print collected values to debug log */
+    static void dump();
+};
+
+#ifdef PQCONSOLE_SYNC_METRICS
+
+/** a mutex accounting acquisitions and time spent waiting on lock */
+class PQCONSOLECORE_EXPORT sync_mutex : public QMutex {
+public:
+    explicit sync_mutex(sync_point *point) : point(point) {}
+    void lock() {
+        if (tryLock())
+            point->record(0, false);
+        else {
+            QElapsedTimer t;
+            t.start();
+            QMutex::lock();
+            point->record(t.nsecsElapsed(), true);
+        }
+    }
+private:
+    sync_point *point;
+};
+
+/** scoped lock of a sync_mutex (QMutexLocker would bypass accounting) */
+class sync_locker {
+public:
+    explicit sync_locker(sync_mutex *m) : m(m) { m->lock(); }
+    ~sync_locker() { m->unlock(); }
+private:
+    sync_mutex *m;
+    Q_DISABLE_COPY(sync_locker)
+};
+
+/** account the lifetime of the scope as a wait */
+class sync_wait {
+public:
+    explicit sync_wait(sync_point &point) : point(point), waited(false) { t.start(); }
+    ~sync_wait() { point.record(t.nsecsElapsed(), waited); }
+    /** mark as actually blocked */
+    void blocked() { waited = true; }
+private:
+    sync_point &point;
+    QElapsedTimer t;
+    bool waited;
+    Q_DISABLE_COPY(sync_wait)
+};
+
+#else
+
+class sync_mutex : public QMutex {
+public:
+    explicit sync_mutex(sync_point *) {}
+};
+
+typedef QMutexLocker sync_locker;
+
+class sync_wait {
+public:
+    explicit sync_wait(sync_point &) {}
+    void blocked() {}
+};
+
+#endif
+
+/** process startup events, timed from library load
+ */
+struct PQCONSOLECORE_EXPORT startup_timeline {
+
+    /** record - and log - first occurrence of event */
+    static void mark(const char *event);
+
+    /** event -> milliseconds */
+    typedef QList< QPair<const char*, qint64> > t_events;
+    static t_events events();
+};
+
+#endif // SYNCMETRICS_H
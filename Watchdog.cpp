@@ -0,0 +1,380 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define PROLOG_MODULE "pqConsole"
+#include "PREDICATE.h"
+#include "Watchdog.h"
+#include "SyncMetrics.h"
+#include "GuiTaskQueue.h"
+#include "SwiPrologEngine.h"
+
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+#include <QDateTime>
+#include <QSettings>
+#include <QElapsedTimer>
+#include <QThreadStorage>
+#include <QStandardPaths>
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#if defined(__GLIBC__)
+#define WATCHDOG_NATIVE_TRACE
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+/** stall threshold, milliseconds: 0 when disabled */
+static QAtomicInt stall_threshold;
+
+/** request monitoring thread termination */
+static QAtomicInt quitting;
+
+/** the monitor, constructed in GUI thread when first enabled */
+static QAtomicPointer<Watchdog> the_watchdog;
+
+/** monotonic clock shared by all hearts */
+static QElapsedTimer watchdog_clock;
+static struct watchdog_clock_start {
+    watchdog_clock_start() { watchdog_clock.start(); }
+} watchdog_clock_start_;
+
+/** beats before enabling don't count */
+static std::atomic<qint64> enabled_at(0);
+
+/** stall durations, accounted when the thread resumes: reported in any build */
+static sync_point gui_stall_point("Watchdog GUI stall", true);
+static sync_point engine_stall_point("Watchdog engine stall", true);
+
+/** a monitored thread: timestamp written by owner, read by watchdog
+ */
+struct heart {
+    heart(const char *name, bool prolog_thread);
+    ~heart();
+
+    const char *name;
+    int pl_thid;
+    sync_point *stalls;
+    std::atomic<qint64> last_ms;
+
+    /** last beat seen when stall was reported, -1 if not stalled: watchdog thread only */
+    qint64 stalled_at;
+
+    /** stall start: last beat, or enabling time if later */
+    qint64 stalled_from;
+
+#ifdef WATCHDOG_NATIVE_TRACE
+    pthread_t native;
+#endif
+};
+
+/** registered hearts, unlinked when owner thread exits
+ */
+static QMutex hearts_sync;
+static QList<heart*> hearts;    // syncronized !
+static QThreadStorage<heart*> current_heart;
+
+heart::heart(const char *name, bool prolog_thread)
+    : name(name),
+      pl_thid(prolog_thread ? PL_thread_self() : -1),
+      stalls(prolog_thread ? &engine_stall_point : &gui_stall_point),
+      last_ms(watchdog_clock.elapsed()),
+      stalled_at(-1),
+      stalled_from(0)
+{
+#ifdef WATCHDOG_NATIVE_TRACE
+    native = pthread_self();
+#endif
+    QMutexLocker lk(&hearts_sync);
+    hearts.append(this);
+}
+
+/** serialize writes to report file
+ *  also held while signaling a reported thread: it can't unregister (and exit) meanwhile
+ */
+static QMutex log_sync;
+
+heart::~heart() {
+    QMutexLocker ll(&log_sync);
+    QMutexLocker lk(&hearts_sync);
+    hearts.removeOne(this);
+}
+
+/** copy of a stalled heart, reported after hearts_sync is released
+ */
+struct stall {
+    heart *h;
+    const char *name;
+    int pl_thid;
+    qint64 stalled_ms;
+};
+
+#ifdef WATCHDOG_NATIVE_TRACE
+
+/** handshake with signal handler */
+static std::atomic<int> trace_fd(-1);
+static std::atomic<bool> trace_done(false);
+
+/** a realtime signal, not used by SWI-Prolog */
+static int trace_signal() { return SIGRTMIN + 2; }
+
+/** runs in the stalled thread: dump its stack to trace_fd
+ */
+static void trace_handler(int) {
+    void *frames[64];
+    int n = backtrace(frames, 64);
+    int fd = trace_fd.load();
+    if (fd >= 0)
+        backtrace_symbols_fd(frames, n, fd);
+    trace_done = true;
+}
+
+static void install_trace_handler() {
+    // first call loads the unwinder, that's not safe inside a handler
+    void *frames[1];
+    backtrace(frames, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(trace_signal(), &sa, 0);
+}
+
+/** still registered ? - log_sync held, so it stays valid until released
+ */
+static bool alive(heart *h) {
+    QMutexLocker lk(&hearts_sync);
+    return hearts.contains(h);
+}
+
+/** signal the stalled thread, and wait - up to 1 second - its stack is written
+ *  log_sync held and h alive
+ */
+static bool native_trace(heart *h, int fd) {
+    trace_fd = fd;
+    trace_done = false;
+    if (pthread_kill(h->native, trace_signal()) == 0)
+        for (int w = 0; w < 100 && !trace_done; ++w)
+            QThread::msleep(10);
+    trace_fd = -1;
+    return trace_done;
+}
+
+#endif
+
+/** ask the stalled engine to log its Prolog stack
+ *  served when the engine next handles signals, i.e. not while blocked in foreign code
+ */
+static void prolog_trace(int thid) {
+    if (!SwiPrologEngine::is_ready())
+        return;
+    try {
+        SwiPrologEngine::in_thread e;
+        QString goal = QString(
+            "thread_signal(%1, catch((get_prolog_backtrace(40, B),"
+            " with_output_to(string(S), (current_output(O), print_prolog_backtrace(O, B))),"
+            " pqConsole:watchdog_log(S)), _, true))").arg(thid);
+        PlCall(WCS(goal));
+    }
+    catch(PlException ex) {
+        qDebug() << "Watchdog" << thid << t2w(ex);
+    }
+}
+
+/** log and capture stacks of a stalled thread - hearts_sync not held,
+ *  so beating and (un)registering threads don't wait for the traces
+ */
+static void report(const stall &s) {
+    QString head = QString("%1 %2 (Prolog thread %3) stalled for %4 ms\n")
+        .arg(QDateTime::currentDateTime().toString(Qt::ISODate))
+        .arg(s.name).arg(s.pl_thid).arg(s.stalled_ms);
+    qDebug() << "Watchdog" << head.trimmed();
+
+    {   QMutexLocker lk(&log_sync);
+        QFile f(Watchdog::log_path());
+        if (f.open(QIODevice::Append)) {
+            f.write(head.toUtf8());
+            f.flush();
+#ifdef WATCHDOG_NATIVE_TRACE
+            if (!alive(s.h))
+                f.write("thread exited before backtrace\n");
+            else if (!native_trace(s.h, f.handle()))
+                f.write("native backtrace not delivered\n");
+#else
+            f.write("native backtrace not available on this platform\n");
+#endif
+        }
+    }
+
+    if (s.pl_thid > 0)
+        prolog_trace(s.pl_thid);
+}
+
+Watchdog::Watchdog() {
+    gui_timer = new QTimer(this);
+    connect(gui_timer, SIGNAL(timeout()), this, SLOT(gui_beat()));
+#ifdef WATCHDOG_NATIVE_TRACE
+    install_trace_handler();
+#endif
+}
+
+/** read threshold from user settings
+ */
+void Watchdog::setup() {
+    QSettings s("SWI-Prolog", "pqConsole");
+    set_stall_ms(s.value("watchdog_stall_ms", 0).toInt());
+}
+
+void Watchdog::set_stall_ms(int ms) {
+    ms = qMax(ms, 0);
+    if (ms && !stall_threshold.load())
+        enabled_at = watchdog_clock.elapsed();
+    stall_threshold.store(ms);
+    GuiTaskQueue::post(&Watchdog::apply);
+}
+
+int Watchdog::stall_ms() {
+    return stall_threshold.load();
+}
+
+/** start monitor on first enable, and tune GUI heartbeat
+ */
+void Watchdog::apply() {
+    int ms = stall_threshold.load();
+    Watchdog *w = the_watchdog.load();
+    if (ms && !w) {
+        the_watchdog.store(w = new Watchdog);
+        w->start();
+    }
+    if (w) {
+        if (ms)
+            w->gui_timer->start(qBound(50, ms / 4, 1000));
+        else
+            w->gui_timer->stop();
+    }
+}
+
+/** register on first call from a thread, then just timestamp
+ */
+void Watchdog::beat(const char *name, bool prolog_thread) {
+    if (!stall_threshold.load())
+        return;
+    heart *h = current_heart.localData();
+    if (!h) {
+        h = new heart(name, prolog_thread);
+        current_heart.setLocalData(h);
+    }
+    h->last_ms = watchdog_clock.elapsed();
+}
+
+void Watchdog::gui_beat() {
+    beat("GUI", false);
+}
+
+void Watchdog::shutdown() {
+    quitting.store(1);
+    if (Watchdog *w = the_watchdog.load())
+        w->wait(2000);
+}
+
+QString Watchdog::log_path() {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (dir.isEmpty() || !QDir().mkpath(dir))
+        dir = QDir::tempPath();
+    return dir + "/watchdog.log";
+}
+
+void Watchdog::log(const QByteArray &text) {
+    QMutexLocker lk(&log_sync);
+    QFile f(log_path());
+    if (f.open(QIODevice::Append))
+        f.write(text);
+}
+
+void Watchdog::run() {
+    while (!quitting.load()) {
+        if (stall_threshold.load())
+            check();
+        int ms = stall_threshold.load();
+        msleep(ms ? qBound(50, ms / 4, 1000) : 250);
+    }
+}
+
+/** report each stall once, account its duration when thread beats again
+ *  hearts are scanned under hearts_sync, logging and tracing happen after release
+ */
+void Watchdog::check() {
+    int ms = stall_threshold.load();
+    QList<stall> stalled;
+    QByteArray resumed;
+    {   QMutexLocker lk(&hearts_sync);
+        qint64 now = watchdog_clock.elapsed(), from = enabled_at.load();
+        foreach (heart *h, hearts) {
+            qint64 last = h->last_ms.load();
+            if (h->stalled_at >= 0) {
+                if (last != h->stalled_at) {
+                    qint64 d = last - h->stalled_from;
+                    h->stalls->record(d * 1000000, true);
+                    resumed += QString("%1 %2 (Prolog thread %3) resumed after %4 ms\n")
+                        .arg(QDateTime::currentDateTime().toString(Qt::ISODate))
+                        .arg(h->name).arg(h->pl_thid).arg(d).toUtf8();
+                    h->stalled_at = -1;
+                }
+            }
+            else if (now - qMax(last, from) > ms) {
+                h->stalled_at = last;
+                h->stalled_from = qMax(last, from);
+                stall s = { h, h->name, h->pl_thid, now - h->stalled_from };
+                stalled.append(s);
+            }
+        }
+    }
+    if (!resumed.isEmpty())
+        log(resumed);
+    foreach (const stall &s, stalled)
+        report(s);
+}
+
+/** watchdog(?StallMs)
+ *  get or set the stall threshold, milliseconds: 0 disables
+ */
+PREDICATE(watchdog, 1) {
+    if (PL_A1.type() == PL_VARIABLE)
+        return PL_A1 = long(Watchdog::stall_ms());
+    Watchdog::set_stall_ms(int(long(PL_A1)));
+    return TRUE;
+}
+
+/** watchdog_log(+Text)
+ *  append Text to report log: used by stalled engines to report their stack
+ */
+PREDICATE(watchdog_log, 1) {
+    Watchdog::log(QString("Prolog thread %1 backtrace:\n%2\n")
+        .arg(PL_thread_self()).arg(t2w(PL_A1)).toUtf8());
+    return TRUE;
+}
@@ -0,0 +1,84 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include "pqConsole_global.h"
+
+#include <QThread>
+#include <QTimer>
+
+/** responsiveness watchdog
+ *  GUI event loop and engines' read loops beat a timestamp: when a thread
+ *  doesn't beat for longer than the stall threshold, native and Prolog
+ *  backtraces of that thread are appended to watchdog.log (in user cache),
+ *  and the stall duration is accounted as a sync_point when it resumes.
+ *  Disabled by default: enable by setting watchdog_stall_ms, or watchdog/1
+ */
+class PQCONSOLECORE_EXPORT Watchdog : public QThread {
+    Q_OBJECT
+public:
+
+    /** apply configured threshold - call from GUI thread */
+    static void setup();
+
+    /** change stall threshold, 0 disables */
+    static void set_stall_ms(int ms);
+    static int stall_ms();
+
+    /** timestamp calling thread - a cheap test when disabled */
+    static void beat(const char *name, bool prolog_thread = true);
+
+    /** terminate monitoring thread */
+    static void shutdown();
+
+    /** where reports are appended */
+    static QString log_path();
+
+    /** append to report log, serialized */
+    static void log(const QByteArray &text);
+
+protected:
+
+    /** monitoring loop */
+    virtual void run();
+
+private slots:
+
+    /** GUI heartbeat */
+    void gui_beat();
+
+private:
+
+    Watchdog();
+
+    /** start or stop GUI heartbeat after threshold change - in GUI thread */
+    static void apply();
+
+    /** check all hearts, report new stalls */
+    void check();
+
+    QTimer *gui_timer;
+};
+
+#endif // WATCHDOG_H
@@ -0,0 +1,146 @@
+/*
+    pqConsole    : interfacing SWI-Prolog and Qt
+
+    Author       : Carlo Capelli
+    E-mail       : cc.carlo.cap@gmail.com
+    Copyright (C): 2013, Carlo Capelli
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "PREDICATE.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QStringList>
+#include <string>
+
+/** QString <-> Prolog text conversion timings
+ *  each case runs the conversion <iterations> times on a set of samples,
+ *  std::wstring based (as before PREDICATE.h helpers) and direct
+ */
+
+static QTextStream out(stdout);
+
+/** samples: short and long, ISO Latin-1 and wide */
+static QStringList samples() {
+    QString latin = QString::fromLatin1("member"), wide = QString::fromUtf8("\xce\xbb_term_\xe2\x86\x92");
+    return QStringList()
+        << latin
+        << QString::fromLatin1("citt\xe0 ").repeated(40)
+        << wide
+        << wide.repeated(20);
+}
+
+/** time f over samples, in a frame rewound by each iteration */
+template<class F> static void run(QString name, int iterations, const QStringList &texts, F f) {
+    QElapsedTimer t;
+    t.start();
+    {   PlFrame fr;
+        for (int i = 0; i < iterations; ++i) {
+            foreach (const QString &s, texts)
+                f(s);
+            fr.rewind();
+        }
+    }
+    qint64 ns = t.nsecsElapsed();
+    out << qSetFieldWidth(32) << left << name << qSetFieldWidth(0)
+        << double(ns) / (double(iterations) * texts.size()) << " ns/op" << endl;
+}
+
+/** text read back from a term of each sample */
+template<class Make> static QList<PlTerm> terms(const QStringList &texts, Make make) {
+    QList<PlTerm> l;
+    foreach (const QString &s, texts)
+        l.append(make(s));
+    return l;
+}
+
+template<class F> static void run_read(QString name, int iterations, const QList<PlTerm> &l, F f) {
+    QElapsedTimer t;
+    t.start();
+    int len = 0;
+    for (int i = 0; i < iterations; ++i)
+        foreach (const PlTerm &x, l)
+            len += f(x).length();
+    qint64 ns = t.nsecsElapsed();
+    out << qSetFieldWidth(32) << left << name << qSetFieldWidth(0)
+        << double(ns) / (double(iterations) * l.size()) << " ns/op" << endl;
+    Q_UNUSED(len)
+}
+
+static PlTerm codes(const QString &s) {
+    PlTerm t;
+    WCS w(s);
+    PL_unify_wchars(t.ref, PL_CODE_LIST, w.length(), w);
+    return t;
+}
+
+int main(int argc, char **argv) {
+    QCoreApplication a(argc, argv);
+    int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+
+    char *pl_argv[] = { argv[0], const_cast<char*>("-q"), 0 };
+    if (!PL_initialise(2, pl_argv)) {
+        out << "PL_initialise failed" << endl;
+        return 1;
+    }
+
+    QStringList texts = samples();
+    out << "iterations: " << iterations << ", samples: " << texts.size() << endl;
+
+    out << "-- QString to atom" << endl;
+    run("std::wstring", iterations, texts, [](const QString &s) {
+        PlAtom x(s.toStdWString().data()); Q_UNUSED(x); });
+    run("W", iterations, texts, [](const QString &s) {
+        PlAtom x = W(s); Q_UNUSED(x); });
+
+    out << "-- QString to string" << endl;
+    run("std::wstring", iterations, texts, [](const QString &s) {
+        PlString x(s.toStdWString().data()); Q_UNUSED(x); });
+    run("w2s", iterations, texts, [](const QString &s) {
+        PlTerm x = w2s(s); Q_UNUSED(x); });
+
+    out << "-- QString to code list" << endl;
+    run("std::wstring", iterations, texts, [](const QString &s) {
+        std::wstring w = s.toStdWString();
+        PlTerm x;
+        PL_unify_wchars(x.ref, PL_CODE_LIST, size_t(-1), w.data()); });
+    run("WCS", iterations, texts, [](const QString &s) {
+        PlTerm x = codes(s); Q_UNUSED(x); });
+
+    PlFrame fr;
+    QList<PlTerm>
+        atoms = terms(texts, [](const QString &s) { return PlTerm(W(s)); }),
+        strings = terms(texts, [](const QString &s) { return w2s(s); }),
+        lists = terms(texts, codes);
+
+    auto before = [](const PlTerm &t) { return QString::fromWCharArray(WCP(t)); };
+    out << "-- atom to QString" << endl;
+    run_read("fromWCharArray", iterations, atoms, before);
+    run_read("t2w", iterations, atoms, t2w);
+
+    out << "-- string to QString" << endl;
+    run_read("fromWCharArray", iterations, strings, before);
+    run_read("t2w", iterations, strings, t2w);
+
+    out << "-- code list to QString" << endl;
+    run_read("fromWCharArray", iterations, lists, before);
+    run_read("t2w", iterations, lists, t2w);
+
+    PL_halt(0);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#--------------------------------------------------
+# text_bench.pro: QString <-> Prolog text conversion timings
+#--------------------------------------------------
+#
+# compares the PREDICATE.h helpers (W, WCS, w2s, t2w) with the
+# std::wstring based conversions they replaced, on atoms,
+# strings and code lists. Run from a console:
+#   qmake && make && ./text_bench [iterations]
+#--------------------------------------------------
+
+QT = core
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = text_bench
+TEMPLATE = app
+
+INCLUDEPATH += $$PWD/..
+DEFINES += PL_SAFE_ARG_MACROS
+
+!macx: QMAKE_CXXFLAGS += -std=c++0x
+
+SOURCES += text_bench.cpp
+
+macx {
+    QT_CONFIG -= no-pkg-config
+    SWIPL_CXXFLAGS = $$system("pkg-config --cflags swipl")
+    SWIPL_CXXFLAGS = $$replace(SWIPL_CXXFLAGS, "-I/opt/local/include", "")
+    QMAKE_CXXFLAGS += $$SWIPL_CXXFLAGS
+    QMAKE_LFLAGS += $$system("pkg-config --libs-only-L --libs-only-l swipl")
+    CONFIG += c++11
+}
+
+unix:!macx {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += swipl
+}
+
+win32 {
+    contains(QMAKE_HOST.arch, x86_64) {
+       SwiPl = "C:\Program Files\swipl"
+    } else {
+       SwiPl = "C:\Program Files (x86)\swipl"
+    }
+    INCLUDEPATH += $$SwiPl\include
+    LIBS += -L$$SwiPl\lib
+    win32-msvc*: {
+        CONFIG += c++11
+        DEFINES += ssize_t=intptr_t
+        QMAKE_LFLAGS += libswipl.dll.a
+    } else {
+        LIBS += -lswipl
+    }
+}
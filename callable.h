@@ -6,7 +6,7 @@
 #include "pqConsole_global.h"
 
 /** callable abstraction */
-struct PQCONSOLESHARED_EXPORT callable : QObject {
+struct PQCONSOLECORE_EXPORT callable : QObject {
     Q_OBJECT
 public:
     explicit callable(PlTermv args, bool trace = 0, QObject *p = 0);
@@ -18,7 +18,7 @@ bool pqApplication::event(QEvent *event) {
         qDebug() << "FileOpen: " << name;
         SwiPrologEngine::in_thread _it;
         try {
-            PlCall("prolog", "file_open_event", PlTermv(name.toStdWString().data()));
+            PlCall("prolog", "file_open_event", PlTermv(PlTerm(WCS(name))));
         } catch(PlException e) {
             qDebug() << CCP(e);
         }
@@ -35,6 +35,7 @@
 
 #include <QTime>
 #include <QStack>
+#include <QThreadStorage>
 #include <QDebug>
 #include <QMenuBar>
 #include <QClipboard>
@@ -99,47 +100,113 @@ ConsoleEdit *pqConsole::peek_first() {
 #endif
 
 QList<ConsoleEdit*> pqConsole::consoles;
-QMutex pqConsole::consoles_sync;
+
+static sync_point consoles_sync_point("pqConsole::consoles_sync");
+sync_mutex pqConsole::consoles_sync(&consoles_sync_point);
+
+pqConsole::t_thread_map pqConsole::thread_map;
+QAtomicInt pqConsole::thread_map_version;
+
+/** last by_thread() result of a thread
+ */
+struct thread_console {
+    int thid;
+    int version;
+    ConsoleEdit *ce;
+};
+static QThreadStorage<thread_console*> thread_console_cache;
 
 void pqConsole::addConsole(ConsoleEdit* c) {
-    QMutexLocker l(&consoles_sync);
+    sync_locker l(&consoles_sync);
     Q_ASSERT(!consoles.contains(c));
     consoles.append(c);
+    update_thread_map();
 }
 
 void pqConsole::removeConsole(ConsoleEdit* c) {
-    QMutexLocker l(&consoles_sync);
+    sync_locker l(&consoles_sync);
     Q_ASSERT(consoles.contains(c));
     consoles.removeOne(c);
+    update_thread_map();
 }
 
-/** search widgets hierarchy looking for the first (the only)
- *  that owns the calling thread ID
+/** bind/unbind a Prolog thread to a console
+ */
+void pqConsole::bind_thread(ConsoleEdit *c, int thread_id, bool bind) {
+    sync_locker l(&consoles_sync);
+    if (bind)
+        c->thids.append(thread_id);
+    else
+        c->thids.removeOne(thread_id);
+    update_thread_map();
+}
+
+/** rebuild map from consoles list, invalidating threads' cached lookups
+ *  must be called with consoles_sync locked
+ */
+void pqConsole::update_thread_map() {
+    thread_map.clear();
+    foreach (ConsoleEdit *ce, consoles)
+        foreach (int id, ce->thids)
+            if (id >= 0) {
+                if (thread_map.size() <= id)
+                    thread_map.resize(id + 1);
+                if (!thread_map[id])    // first console wins, as by sequential search
+                    thread_map[id] = ce;
+            }
+    thread_map_version.fetchAndAddOrdered(1);
+}
+
+/** lookup the console that owns the calling thread ID
+ *  the calling thread's cached result is reused while map and thread ID are unchanged,
+ *  else the map is indexed by PL_thread_self() under consoles_sync
  */
 ConsoleEdit *pqConsole::by_thread() {
-    QMutexLocker l(&consoles_sync);
     int thid = PL_thread_self();
-    foreach (ConsoleEdit *ce, consoles)
-        if (ce->match_thread(thid))
-            return ce;
-    return 0;
+    if (thid < 0) {
+        // no engine: any console matches
+        sync_locker l(&consoles_sync);
+        return consoles.isEmpty() ? 0 : consoles[0];
+    }
+
+    thread_console *c = thread_console_cache.localData();
+    if (!c) {
+        c = new thread_console;
+        c->thid = c->version = -1;
+        c->ce = 0;
+        thread_console_cache.setLocalData(c);
+    }
+    if (c->thid == thid && c->version == thread_map_version.loadAcquire())
+        return c->ce;
+
+    sync_locker l(&consoles_sync);
+    c->thid = thid;
+    c->version = thread_map_version.load();
+    c->ce = thid < thread_map.size() ? thread_map[thid] : 0;
+    return c->ce;
 }
 
 /** search widgets hierarchy looking for any ConsoleEdit
  */
 ConsoleEdit *pqConsole::peek_first() {
-    QMutexLocker l(&consoles_sync);
+    sync_locker l(&consoles_sync);
     Q_ASSERT(!consoles.isEmpty());
     return consoles[0];
 }
 
 /** rendez vous in GUI thread, syncronized
+ *  an exception thrown by f is rethrown in the calling thread
  */
 void pqConsole::gui_run(pfunc f) {
     ConsoleEdit::exec_sync s;
     peek_first()->exec_func([&]() {
-        f();
-        s.go();
+        try {
+            f();
+            s.go();
+        }
+        catch(...) {
+            s.fail();
+        }
     });
     s.stop();
 }
@@ -149,9 +216,9 @@ void pqConsole::gui_run(pfunc f) {
 PREDICATE(rl_add_history, 1) {
     ConsoleEdit* c = pqConsole::by_thread();
     if (c) {
-        WCP line = PL_A1;
-        if (*line)
-            c->add_history_line(QString::fromWCharArray(line));
+        QString line = t2w(PL_A1);
+        if (!line.isEmpty())
+            c->add_history_line(line);
         return TRUE;
     }
     return FALSE;
@@ -174,14 +241,14 @@ NAMED_PREDICATE("$rl_history", rl_history, 1) {
     if (c) {
         PlTail lines(PL_A1);
         foreach(QString x, c->history_lines())
-            lines.append(W(x));
+            lines.append(w2s(x));
         lines.close();
         return TRUE;
     }
     */
     PlTail lines(PL_A1);
     foreach(QString x, pqConsole::last_history_lines)
-        lines.append(W(x));
+        lines.append(w2s(x));
     lines.close();
     return TRUE;
 }
@@ -241,7 +308,7 @@ PREDICATE(console_settings, 1) {
             if (opt.arity() == 1)
                 pqConsole::unify(opt.name(), c, opt[1]);
             else
-                throw PlException(A(c->tr("%1: properties have arity 1").arg(t2w(opt))));
+                throw PlException(w2s(c->tr("%1: properties have arity 1").arg(t2w(opt))));
         }
         return TRUE;
     }
@@ -256,7 +323,7 @@ PREDICATE(getOpenFileName, 4) {
     ConsoleEdit* c = pqConsole::by_thread();
     if (c) {
         QString Caption = t2w(PL_A1), StartPath, Pattern = t2w(PL_A3), Choice;
-        if (PL_A2.type() == PL_ATOM)
+        if (PL_A2.type() == PL_ATOM || PL_A2.type() == PL_STRING)
             StartPath = t2w(PL_A2);
 
         ConsoleEdit::exec_sync s;
@@ -268,7 +335,7 @@ PREDICATE(getOpenFileName, 4) {
         s.stop();
 
         if (!Choice.isEmpty()) {
-            PL_A4 = A(Choice);
+            PL_A4 = w2s(Choice);
             return TRUE;
         }
     }
@@ -283,7 +350,7 @@ PREDICATE(getSaveFileName, 4) {
     ConsoleEdit* c = pqConsole::by_thread();
     if (c) {
         QString Caption = t2w(PL_A1), StartPath, Pattern = t2w(PL_A3), Choice;
-        if (PL_A2.type() == PL_ATOM)
+        if (PL_A2.type() == PL_ATOM || PL_A2.type() == PL_STRING)
             StartPath = t2w(PL_A2);
 
         ConsoleEdit::exec_sync s;
@@ -294,7 +361,7 @@ PREDICATE(getSaveFileName, 4) {
         s.stop();
 
         if (!Choice.isEmpty()) {
-            PL_A4 = A(Choice);
+            PL_A4 = w2s(Choice);
             return TRUE;
         }
     }
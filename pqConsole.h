@@ -28,6 +28,8 @@
 
 #include <QMetaObject>
 #include <QMetaProperty>
+#include <QAtomicInt>
+#include <QVector>
 #include <QMutex>
 
 /*!
@@ -64,6 +66,9 @@ public:
     /** search widgets hierarchy looking for the first */
     static ConsoleEdit *by_thread();
 
+    /** bind/unbind a Prolog thread to a console, keeping by_thread() lookup in sync */
+    static void bind_thread(ConsoleEdit *c, int thread_id, bool bind = true);
+
     /** search widgets hierarchy looking for any ConsoleEdit */
     static ConsoleEdit *peek_first();
 
@@ -81,7 +86,16 @@ public:
 
 private:
     static QList<ConsoleEdit*> consoles;
-    static QMutex consoles_sync;
+    static sync_mutex consoles_sync;
+
+    /** Prolog thread id -> console, rebuilt and read under consoles_sync.
+     *  Each thread caches its lookup, valid while thread_map_version is unchanged:
+     *  the common path reads only the (rarely written) version.
+     */
+    typedef QVector<ConsoleEdit*> t_thread_map;
+    static t_thread_map thread_map;
+    static QAtomicInt thread_map_version;
+    static void update_thread_map();
 };
 
 #endif // PQCONSOLE_H
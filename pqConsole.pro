@@ -17,44 +17,41 @@ DEFINES += PQCONSOLE_LIBRARY
 # moved where the class is defined
 # DEFINES += PQCONSOLE_BROWSER
 
-# prevent symbol/macro clashes with Qt
-DEFINES += PL_SAFE_ARG_MACROS
+# engine, IO streams and query API (QtCore only) come from pqConsoleCore:
+# build both with pqConsoleLibs.pro, or pqConsoleCore.pro first
+include(pqConsoleCore.pri)
 
-# please, not obsolete compiler
-!macx: QMAKE_CXXFLAGS += -std=c++0x
+LIBS += -L$$OUT_PWD
+win32 {
+    CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/debug
+    else: LIBS += -L$$OUT_PWD/release
+}
+LIBS += -lpqConsoleCore
 
+# console widgets
 SOURCES += \
     pqConsole.cpp \
-    SwiPrologEngine.cpp \
     ConsoleEdit.cpp \
-    pqTerm.cpp \
     Completion.cpp \
-    Swipl_IO.cpp \
+    CompletionIndex.cpp \
     pqMainWindow.cpp \
     Preferences.cpp \
-    FlushOutputEvents.cpp \
     pqApplication.cpp \
     win_builtins.cpp \
-    callable.cpp \
     reflexive.cpp \
-    ParenMatching.cpp
+    ParenMatching.cpp \
+    PrologHighlighter.cpp
 
 HEADERS += \
     pqConsole.h \
-    pqConsole_global.h \
-    SwiPrologEngine.h \
     ConsoleEdit.h \
-    PREDICATE.h \
-    pqTerm.h \
     Completion.h \
-    Swipl_IO.h \
+    CompletionIndex.h \
     pqMainWindow.h \
     Preferences.h \
-    do_events.h \
-    FlushOutputEvents.h \
     pqApplication.h \
-    callable.h \
-    ParenMatching.h
+    ParenMatching.h \
+    PrologHighlighter.h
 
 symbian {
     MMP_RULES += EXPORTUNFROZEN
@@ -66,61 +63,11 @@ symbian {
     DEPLOYMENT += addFiles
 }
 
-macx {
-    QT_CONFIG -= no-pkg-config
-    # The mac build of qmake has pkg-config support disabled by default, see
-    # http://stackoverflow.com/a/16972067/1329652
-    !system(pkg-config --exists swipl):error("pkg-config indicates that swipl is missing.")
-    SWIPL_CXXFLAGS = $$system("pkg-config --cflags swipl")
-    # remove the macports include path since it'll interfere with Qt
-    SWIPL_CXXFLAGS = $$replace(SWIPL_CXXFLAGS, "-I/opt/local/include", "")
-    SWIPL_LFLAGS = $$system("pkg-config --libs-only-L --libs-only-l swipl")
-    QMAKE_CXXFLAGS += $$SWIPL_CXXFLAGS
-    QMAKE_LFLAGS += $$SWIPL_LFLAGS
-
-    greaterThan(QT_MAJOR_VERSION, 4): {
-        CONFIG += c++11
-        cache()
-    } else {
-        QMAKE_CXXFLAGS += -stdlib=libc++ -std=c++0x
-        QMAKE_LFLAGS += -stdlib=libc++
-    }
-}
-
-unix:!symbian:!macx {
-    # because SWI-Prolog is built from source
-    CONFIG += link_pkgconfig
-    PKGCONFIG += swipl
-
-    maemo5 {
-        target.path = /opt/usr/lib
-    } else {
-        target.path = /usr/lib
-    }
-
-    INSTALLS += target
-}
-
-win32 {
-    contains(QMAKE_HOST.arch, x86_64) {
-       SwiPl = "C:\Program Files\swipl"
-    } else {
-       SwiPl = "C:\Program Files (x86)\swipl"
-    }
-    INCLUDEPATH += $$SwiPl\include
-    LIBS += -L$$SwiPl\lib
-    win32-msvc*: {
-        CONFIG += c++11
-        DEFINES += ssize_t=intptr_t
-        QMAKE_LFLAGS += libswipl.dll.a
-    } else {
-        QMAKE_CXXFLAGS += -std=c++0x
-        LIBS += -lswipl
-    }
-}
-
 OTHER_FILES += \
     README.md \
+    pqConsoleCore.pri \
+    pqConsoleCore.pro \
+    pqConsoleLibs.pro \
     pqConsole.doxy \
     swipl.png
 
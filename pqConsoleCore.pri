@@ -0,0 +1,74 @@
+#--------------------------------------------------
+# pqConsoleCore.pri: build settings of SWI-Prolog clients
+#--------------------------------------------------
+#
+# include path, defines, compiler and swipl flags, shared by
+#  pqConsoleCore.pro (headless library, QtCore only)
+#  pqConsole.pro (console widgets, linked to pqConsoleCore)
+#--------------------------------------------------
+
+INCLUDEPATH += $$PWD
+
+# prevent symbol/macro clashes with Qt
+DEFINES += PL_SAFE_ARG_MACROS
+
+# collect mutex and wait statistics (see SyncMetrics.h), with
+#  qmake CONFIG+=sync_metrics
+# clients must be built with the same setting
+sync_metrics: DEFINES += PQCONSOLE_SYNC_METRICS
+
+# please, not obsolete compiler
+!macx: QMAKE_CXXFLAGS += -std=c++0x
+
+macx {
+    QT_CONFIG -= no-pkg-config
+    # The mac build of qmake has pkg-config support disabled by default, see
+    # http://stackoverflow.com/a/16972067/1329652
+    !system(pkg-config --exists swipl):error("pkg-config indicates that swipl is missing.")
+    SWIPL_CXXFLAGS = $$system("pkg-config --cflags swipl")
+    # remove the macports include path since it'll interfere with Qt
+    SWIPL_CXXFLAGS = $$replace(SWIPL_CXXFLAGS, "-I/opt/local/include", "")
+    SWIPL_LFLAGS = $$system("pkg-config --libs-only-L --libs-only-l swipl")
+    QMAKE_CXXFLAGS += $$SWIPL_CXXFLAGS
+    QMAKE_LFLAGS += $$SWIPL_LFLAGS
+
+    greaterThan(QT_MAJOR_VERSION, 4): {
+        CONFIG += c++11
+        cache()
+    } else {
+        QMAKE_CXXFLAGS += -stdlib=libc++ -std=c++0x
+        QMAKE_LFLAGS += -stdlib=libc++
+    }
+}
+
+unix:!symbian:!macx {
+    # because SWI-Prolog is built from source
+    CONFIG += link_pkgconfig
+    PKGCONFIG += swipl
+
+    maemo5 {
+        target.path = /opt/usr/lib
+    } else {
+        target.path = /usr/lib
+    }
+
+    INSTALLS += target
+}
+
+win32 {
+    contains(QMAKE_HOST.arch, x86_64) {
+       SwiPl = "C:\Program Files\swipl"
+    } else {
+       SwiPl = "C:\Program Files (x86)\swipl"
+    }
+    INCLUDEPATH += $$SwiPl\include
+    LIBS += -L$$SwiPl\lib
+    win32-msvc*: {
+        CONFIG += c++11
+        DEFINES += ssize_t=intptr_t
+        QMAKE_LFLAGS += libswipl.dll.a
+    } else {
+        QMAKE_CXXFLAGS += -std=c++0x
+        LIBS += -lswipl
+    }
+}
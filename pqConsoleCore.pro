@@ -0,0 +1,41 @@
+#--------------------------------------------------
+# pqConsoleCore.pro: SWI-Prolog / QT interface, headless
+#--------------------------------------------------
+#
+# SwiPrologEngine, Swipl_IO streams and query API,
+# without QtGui/QtWidgets: for server side embedding.
+# Front ends implement ConsoleTarget.
+#--------------------------------------------------
+
+QT = core
+
+TARGET = pqConsoleCore
+TEMPLATE = lib
+
+DEFINES += PQCONSOLECORE_LIBRARY
+
+include(pqConsoleCore.pri)
+
+SOURCES += \
+    SwiPrologEngine.cpp \
+    pqTerm.cpp \
+    Swipl_IO.cpp \
+    FlushOutputEvents.cpp \
+    callable.cpp \
+    GuiTaskQueue.cpp \
+    SyncMetrics.cpp \
+    Watchdog.cpp
+
+HEADERS += \
+    pqConsole_global.h \
+    SwiPrologEngine.h \
+    PREDICATE.h \
+    pqTerm.h \
+    Swipl_IO.h \
+    do_events.h \
+    FlushOutputEvents.h \
+    ConsoleTarget.h \
+    callable.h \
+    GuiTaskQueue.h \
+    SyncMetrics.h \
+    Watchdog.h
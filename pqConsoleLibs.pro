@@ -0,0 +1,15 @@
+#--------------------------------------------------
+# pqConsoleLibs.pro: SWI-Prolog / QT interface, all libraries
+#--------------------------------------------------
+#
+# pqConsoleCore (engine, QtCore only) and pqConsole (widgets),
+# the latter linked to the former
+#--------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS = core console
+
+core.file = pqConsoleCore.pro
+console.file = pqConsole.pro
+console.depends = core
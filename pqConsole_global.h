@@ -33,4 +33,13 @@
 #  define PQCONSOLESHARED_EXPORT Q_DECL_IMPORT
 #endif
 
+/** engine and IO classes, exported by pqConsoleCore */
+#if defined(PQCONSOLECORE_LIBRARY)
+#  define PQCONSOLECORE_EXPORT Q_DECL_EXPORT
+#elif defined(PQCONSOLE_STATIC)
+#  define PQCONSOLECORE_EXPORT
+#else
+#  define PQCONSOLECORE_EXPORT Q_DECL_IMPORT
+#endif
+
 #endif // PQCONSOLE_GLOBAL_H
@@ -23,6 +23,14 @@
 #include "pqTerm.h"
 #include "PREDICATE.h"
 
+#include <QUrl>
+#include <QDate>
+#include <QTime>
+#include <QDateTime>
+#include <QRect>
+#include <QLine>
+#include <QStringList>
+
 QVariant term2variant(PlTerm t) {
     switch (t.type()) {
     case PL_VARIABLE:
@@ -42,14 +50,30 @@ QVariant term2variant(PlTerm t) {
     }
 }
 
+/** integer argument */
+static PlTerm I(long i) { return PlTerm(i); }
+
+/** real argument */
+static PlTerm R(double d) { return PlTerm(d); }
+
+/** text is an atom, value types are compounds named after the type, as accepted by pq_property
+ *  (i.e. 'QSize'(W, H), 'QDate'(Y, M, D)): other types raise a type error naming them
+ */
 PlTerm variant2term(const QVariant& v) {
+    CCP n = v.typeName();
     switch (v.type()) {
     case QVariant::Char:
     case QVariant::String:
     case QVariant::ByteArray:
-        return PlTerm(v.toString().toStdWString().data());
+        return PlTerm(WCS(v.toString()));
+    case QVariant::Bool:
+        return PlTerm(v.toBool() ? FA("true") : FA("false"));
     case QVariant::Int:
         return PlTerm(long(v.toInt()));
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+        return PlTerm(long(v.toLongLong()));
     case QVariant::Double:
         return PlTerm(v.toDouble());
     case QVariant::List: {
@@ -60,7 +84,71 @@ PlTerm variant2term(const QVariant& v) {
         l.close();
         return t;
     }
+    case QVariant::StringList: {
+        PlTerm t;
+        PlTail l(t);
+        foreach(QString e, v.toStringList())
+            l.append(W(e));
+        l.close();
+        return t;
+    }
+
+    case QVariant::Size: {
+        QSize x = v.toSize();
+        return C(n, V(I(x.width()), I(x.height())));
+    }
+    case QVariant::SizeF: {
+        QSizeF x = v.toSizeF();
+        return C(n, V(R(x.width()), R(x.height())));
+    }
+    case QVariant::Point: {
+        QPoint x = v.toPoint();
+        return C(n, V(I(x.x()), I(x.y())));
+    }
+    case QVariant::PointF: {
+        QPointF x = v.toPointF();
+        return C(n, V(R(x.x()), R(x.y())));
+    }
+    case QVariant::Rect: {
+        QRect x = v.toRect();
+        return C(n, V(I(x.x()), I(x.y()), I(x.width()), I(x.height())));
+    }
+    case QVariant::RectF: {
+        QRectF x = v.toRectF();
+        return C(n, V(R(x.x()), R(x.y()), R(x.width()), R(x.height())));
+    }
+    case QVariant::Line: {
+        QLine x = v.toLine();
+        return C(n, V(I(x.x1()), I(x.y1()), I(x.x2()), I(x.y2())));
+    }
+    case QVariant::LineF: {
+        QLineF x = v.toLineF();
+        return C(n, V(R(x.x1()), R(x.y1()), R(x.x2()), R(x.y2())));
+    }
+    case QVariant::Date: {
+        QDate x = v.toDate();
+        return C(n, V(I(x.year()), I(x.month()), I(x.day())));
+    }
+    case QVariant::Time: {
+        QTime x = v.toTime();
+        return C(n, V(I(x.hour()), I(x.minute()), I(x.second()), I(x.msec())));
+    }
+    case QVariant::DateTime: {
+        QDateTime x = v.toDateTime();
+        return C(n, V(variant2term(x.date()), variant2term(x.time())));
+    }
+    case QVariant::Url:
+        return C(n, V(W(v.toUrl().toString())));
+
     default:
-        return PlTerm();
+        // a QVariant returned as such
+        if (v.userType() == QMetaType::QVariant)
+            return variant2term(v.value<QVariant>());
+
+        // pointers, as expected by pq_cast
+        if (v.userType() == QMetaType::VoidStar || (QMetaType::typeFlags(v.userType()) & QMetaType::PointerToQObject))
+            return PlTerm(*static_cast<void* const*>(v.constData()));
+
+        throw PlTypeError("prolog_convertible", w2s(n ? n : "invalid"));
     }
 }
@@ -27,7 +27,7 @@
 #include <SWI-cpp.h>
 #include <QVariant>
 
-#define X PQCONSOLESHARED_EXPORT
+#define X PQCONSOLECORE_EXPORT
 
 /** since SWI-Prolog doesn't allow inter thread terms exchange,
  *  this class could be required to truly distribute execution
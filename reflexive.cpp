@@ -23,6 +23,7 @@
 #define PROLOG_MODULE "pqConsole"
 #include "PREDICATE.h"
 #include "pqConsole.h"
+#include "pqTerm.h"
 
 #include <QStack>
 #include <QDebug>
@@ -33,28 +34,90 @@
 #include <QTime>
 #include <QDateTime>
 #include <QPixmap>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QSharedPointer>
 
-//! collect all registered Qt types
-PREDICATE(list_objects_type, 1) {
-    PlTail l(PL_A1);
-    for (int t = 0; t < (1 << 20); ++t)
+/** snapshot of registered Qt types
+ *  builtin ids are below QMetaType::User, user types are allocated sequentially from there:
+ *  the snapshot is extended when the next user id becomes registered
+ */
+struct type_registry {
+    QVector<QByteArray> names;
+    QVector<int> ids;
+    QHash<QByteArray, int> by_name;
+    int next_user;
+
+    type_registry() : next_user(QMetaType::User) {
+        for (int t = 0; t <= QMetaType::HighestInternalId; ++t)
+            add(t);
+    }
+
+    void add(int t) {
         if (QMetaType::isRegistered(t)) {
             const char* n = QMetaType::typeName(t);
-            if (n && *n)
-                l.append(n);
+            if (n && *n) {
+                names.append(n);
+                ids.append(t);
+                by_name.insert(n, t);
+            }
+        }
+    }
+
+    bool stale() const { return QMetaType::isRegistered(next_user); }
+
+    void refresh() {
+        for ( ; QMetaType::isRegistered(next_user); ++next_user)
+            add(next_user);
+    }
+};
+
+static type_registry *types;
+static QReadWriteLock types_lock;
+
+/** ensure the snapshot is up to date, return with read lock held
+ */
+static void types_current(QReadLocker &l) {
+    if (!types || types->stale()) {
+        l.unlock();
+        {   QWriteLocker w(&types_lock);
+            if (!types)
+                types = new type_registry;
+            types->refresh();
         }
-    l.close();
+        l.relock();
+    }
+}
+
+//! collect all registered Qt types
+PREDICATE(list_objects_type, 1) {
+    QReadLocker l(&types_lock);
+    types_current(l);
+
+    PlTail r(PL_A1);
+    foreach (const QByteArray &n, types->names)
+        r.append(n.constData());
+    r.close();
     return TRUE;
 }
 
 //! create a meta-instantiable Qt object
 PREDICATE(create_object, 2) {
     VP obj = 0;
-    QString name = t2w(PL_A1);
-    pqConsole::gui_run([&](){
-       if (int id = QMetaType::type(name.toUtf8()))
-           obj = QMetaType::create(id);  // calls default constructor here
-    });
+    QByteArray name = t2w(PL_A1).toUtf8();
+
+    int id;
+    {   QReadLocker l(&types_lock);
+        types_current(l);
+        id = types->by_name.value(name);
+    }
+    if (!id)
+        id = QMetaType::type(name);    // typedef'd names
+
+    if (id)
+        pqConsole::gui_run([&](){
+            obj = QMetaType::create(id);  // calls default constructor here
+        });
     if (obj)
         return PL_A2 = obj;
     throw PlException("create_object failed");
@@ -68,6 +131,7 @@ static QVariant T2V(PlTerm pl)
     case PL_FLOAT:
         return QVariant(double(pl));
     case PL_ATOM:
+    case PL_STRING:
         return QVariant(t2w(pl));
 
     case PL_TERM: {
@@ -141,110 +205,230 @@ static QVariant T2V(PlTerm pl)
     throw PlException("cannot convert PlTerm to QVariant");
 }
 
+/** argument conversion, selected once per method parameter
+ */
+typedef QVariant (*converter)(PlTerm arg, int vt);
+
+static QVariant mismatch(PlTerm arg) {
+    int t = arg.type();
+    if (t == PL_ATOM || t == PL_STRING || t == PL_INTEGER || t == PL_FLOAT)
+        throw PlException("invalid type");
+    throw PlException("unknown type conversion");
+}
+static QVariant arg_string(PlTerm arg, int) {
+    if (arg.type() == PL_ATOM || arg.type() == PL_STRING)
+        return t2w(arg);
+    return mismatch(arg);
+}
+static QVariant arg_int(PlTerm arg, int) {
+    if (arg.type() == PL_INTEGER)
+        return qlonglong(long(arg));
+    return mismatch(arg);
+}
+static QVariant arg_pointer(PlTerm arg, int vt) {
+    if (arg.type() == PL_INTEGER) {
+        VP p = arg;
+        return QVariant(vt, &p);
+    }
+    return mismatch(arg);
+}
+static QVariant arg_double(PlTerm arg, int) {
+    if (arg.type() == PL_FLOAT)
+        return double(arg);
+    return mismatch(arg);
+}
+static QVariant arg_invalid(PlTerm arg, int) {
+    return mismatch(arg);
+}
+
+static converter converter_for(int vt) {
+    if (vt == QVariant::String)
+        return arg_string;
+    if (vt == QVariant::Int)
+        return arg_int;
+    if (vt == QMetaType::VoidStar ||
+        vt == QMetaType::QObjectStar ||
+        vt == qMetaTypeId<QWidget*>() ||
+        vt >= QMetaType::User)
+        return arg_pointer;
+    if (vt == QVariant::Double)
+        return arg_double;
+    return arg_invalid;
+}
+
+/** a public method resolved by (class, name, arity), with its arguments conversion
+ */
+struct method_entry {
+    QMetaMethod method;
+    int return_type;
+    QVector<int> types;
+    QVector<converter> converters;
+};
+
+struct method_key {
+    const QMetaObject *meta;
+    QByteArray name;
+    int arity;
+    bool operator==(const method_key &k) const { return meta == k.meta && arity == k.arity && name == k.name; }
+};
+inline uint qHash(const method_key &k) {
+    return ::qHash(k.meta) ^ ::qHash(k.name) ^ uint(k.arity);
+}
+
+/** resolved methods: reflection is done on first call only
+ *  classes are static data, so entries are never invalidated
+ */
+static QHash<method_key, method_entry> methods;
+static QReadWriteLock methods_lock;
+
+/** walk from actual class up to QObject, looking for the member
+ *  throw when the name is found with different arity, as before the cache
+ */
+static method_entry resolve_method(const QMetaObject *meta, const QByteArray &name, int arity) {
+    method_key k = { meta, name, arity };
+    {   QReadLocker l(&methods_lock);
+        auto f = methods.constFind(k);
+        if (f != methods.constEnd())
+            return *f;
+    }
+
+    bool found_more = false, found_less = false;
+    for ( ; meta; meta = meta->superClass())
+        for (int i = 0; i < meta->methodCount(); ++i) {
+            QMetaMethod m = meta->method(i);
+            if (m.methodType() == m.Method && m.access() == m.Public && m.name() == name) {
+                if (m.parameterCount() != arity) {
+                    (m.parameterCount() > arity ? found_more : found_less) = true;
+                    continue;
+                }
+                method_entry e;
+                e.method = m;
+                e.return_type = m.returnType() == QMetaType::Void ? 0 : m.returnType();
+                for (int p = 0; p < arity; ++p) {
+                    e.types.append(m.parameterType(p));
+                    e.converters.append(converter_for(m.parameterType(p)));
+                }
+                QWriteLocker l(&methods_lock);
+                methods.insert(k, e);
+                return e;
+            }
+        }
+
+    if (found_more)
+        throw PlException("argument list count mismatch (miss arguments)");
+    if (found_less)
+        throw PlException("argument list count mismatch (too much arguments)");
+    throw PlException("pq_method failed");
+}
+
+/** QMetaMethod::invoke accepts at most 10 arguments
+ */
+enum { max_args = 10 };
+
+/** a call prepared in Prolog thread: arguments are converted before the GUI hop
+ *  and the return value unified after it
+ */
+struct method_call {
+    method_entry e;
+    QVariantList vl;
+    QVariant ret;
+    bool rc;
+
+    method_call(QObject *obj, const QByteArray &name, const QVarLengthArray<term_t, 8> &args) : rc(false) {
+        if (args.size() > max_args)
+            throw PlException("unsupported call (max 10 arguments)");
+        e = resolve_method(obj->metaObject(), name, args.size());
+        for (int i = 0; i < args.size(); ++i)
+            vl.append(e.converters[i](PlTerm(args[i]), e.types[i]));
+        if (e.return_type)
+            ret = QVariant(e.return_type, static_cast<const void*>(0));
+    }
+
+    /** must run in GUI thread */
+    void invoke(QObject *obj) {
+        QGenericArgument a[max_args];
+        for (int i = 0; i < vl.size(); ++i)
+            a[i] = QGenericArgument(vl[i].typeName(), vl[i].constData());
+        QGenericReturnArgument rv;
+        if (e.return_type)
+            rv = QGenericReturnArgument(e.method.typeName(), ret.data());
+        rc = e.method.invoke(obj, Qt::DirectConnection, rv,
+                a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9]);
+    }
+
+    /** return value as term, true for void methods */
+    PlTerm result() const {
+        return e.return_type ? variant2term(ret) : PlTerm(FA("true"));
+    }
+};
+
+/** collect list elements, each with its own term reference
+ */
+static void list_args(PlTerm list, QVarLengthArray<term_t, 8> &args) {
+    for (L Args(list); ; ) {
+        T Arg;
+        if (!Args.next(Arg))
+            break;
+        args.append(Arg.ref);
+    }
+}
+
 /** pq_method(Object, Member, Args, Retv)
  *  note: pointers should be registered to safely exchange them
+ *  Retv is unified with the return value, if the method is not void
  */
 PREDICATE(pq_method, 4) {
     QObject *obj = pq_cast<QObject>(PL_A1);
-    if (obj) {
-        QString Member = t2w(PL_A2);
-        // iterate superClasses
-        for (const QMetaObject *meta = obj->metaObject(); meta; meta = meta->superClass()) {
-            for (int i = 0; i < meta->methodCount(); ++i) {
-                QMetaMethod m = meta->method(i);
-                if (m.methodType() == m.Method && m.access() == m.Public) {
-                    QString sig = m.methodSignature();
-                    if (sig.left(sig.indexOf('(')) == Member) {
-                        QVariantList vl;
-                        QList<QGenericArgument> va;
-
-                        // scan the argument list
-                        L Args(PL_A3); T Arg;
-                        int ipar = 0;
-                        for ( ; Args.next(Arg); ++ipar) {
-
-                            if (ipar == m.parameterTypes().size())
-                                throw PlException("argument list count mismatch (too much arguments)");
-
-                            // match variant type
-                            int vt = QMetaType::type(m.parameterTypes()[ipar]);
-
-                            switch (Arg.type()) {
-                            case PL_ATOM:
-                                switch (vt) {
-                                case QVariant::String:
-                                    vl.append(t2w(Arg));
-                                    break;
-                                default:
-                                    throw PlException("invalid type");
-                                }
-                                break;
-                            case PL_INTEGER:
-                                if (vt == QVariant::Int) {
-                                    qlonglong l = long(Arg);
-                                    vl.append(l);
-                                } else if (vt == QMetaType::VoidStar ||
-                                           vt == QMetaType::QObjectStar ||
-                                           vt == qMetaTypeId<QWidget*>() ||
-                                           vt >= QMetaType::User) {
-                                    VP p = Arg;
-                                    vl.append(QVariant(vt, &p));
-                                }
-                                else
-                                    throw PlException("invalid type");
-                                break;
-                            case PL_FLOAT:
-                                if (vt == QVariant::Double)
-                                    vl.append(double(Arg));
-                                else
-                                    throw PlException("invalid type");
-                                break;
-                            default:
-                                throw PlException("unknown type conversion");
-                            }
-
-                            va.append(QGenericArgument(vl.back().typeName(), vl.back().data()));
-                        }
-
-                        if (ipar < m.parameterTypes().size())
-                            throw PlException("argument list count mismatch (miss arguments)");
-
-                        if (m.parameterTypes().size() > 3)
-                            throw PlException("unsupported call (max 3 arguments)");
-
-                        // optional return value
-                        QGenericReturnArgument rv;
-                        int trv = QMetaType::type(m.typeName());
-
-                        bool rc = false;
-                        pqConsole::gui_run([&]() {
-                            switch (m.parameterTypes().size()) {
-                            case 0:
-                                rc = trv ? m.invoke(obj, rv) : m.invoke(obj);
-                                break;
-                            case 1:
-                                rc = trv ? m.invoke(obj, rv, va[0]) : m.invoke(obj, va[0]);
-                                break;
-                            case 2:
-                                rc = trv ? m.invoke(obj, rv, va[0], va[1]) : m.invoke(obj, va[0], va[1]);
-                                break;
-                            case 3:
-                                rc = trv ? m.invoke(obj, rv, va[0], va[1], va[2]) : m.invoke(obj, va[0], va[1], va[2]);
-                                break;
-                            }
-                        });
-
-                        if (rc && trv) {
-                            // TBD unify return value
-                        }
-
-                        return rc;
-                    }
-                }
-            }
+    if (!obj)
+        throw PlException("pq_method failed");
+
+    QVarLengthArray<term_t, 8> args;
+    list_args(PL_A3, args);
+
+    method_call c(obj, t2w(PL_A2).toUtf8(), args);
+    pqConsole::gui_run([&]() { c.invoke(obj); });
+
+    if (c.rc && c.e.return_type)
+        return PL_A4 = c.result();
+    return c.rc;
+}
+
+/** pq_methods(Object, [Member(Args...)...], Results)
+ *  run a list of calls on Object with a single GUI thread rendez vous
+ *  Results are the return values (true for void methods), fails at first failed call
+ *  (previous calls have been executed)
+ */
+PREDICATE(pq_methods, 3) {
+    QObject *obj = pq_cast<QObject>(PL_A1);
+    if (!obj)
+        throw PlException("pq_methods failed");
+
+    QList<QSharedPointer<method_call>> calls;
+    {   L Calls(PL_A2);
+        for (T Call; Calls.next(Call); ) {
+            QVarLengthArray<term_t, 8> args;
+            for (int i = 1; i <= Call.arity(); ++i)
+                args.append(Call[i].ref);
+            calls.append(QSharedPointer<method_call>(new method_call(obj, Call.name(), args)));
         }
     }
-    throw PlException("pq_method failed");
+
+    pqConsole::gui_run([&]() {
+        foreach (auto c, calls) {
+            c->invoke(obj);
+            if (!c->rc)
+                break;
+        }
+    });
+
+    L Results(PL_A3);
+    foreach (auto c, calls) {
+        if (!c->rc)
+            return FALSE;
+        if (!Results.append(c->result()))
+            return FALSE;
+    }
+    return Results.close();
 }
 
 /** pq_property(Object, Property, Value)
@@ -295,7 +479,7 @@ QString pqConsole::unify(const QMetaProperty& p, QObject *o, PlTerm v) {
 
         switch (p.type()) {
         case QVariant::Bool:
-            v = V.toBool() ? A("true") : A("false");
+            v = V.toBool() ? FA("true") : FA("false");
             OK;
         case QVariant::Int:
             if (p.isEnumType()) {
@@ -347,6 +531,16 @@ QString pqConsole::unify(const QMetaProperty& p, QObject *o, PlTerm v) {
         }
         break;
 
+    case PL_STRING:
+        switch (p.type()) {
+        case QVariant::String:
+            V = t2w(v);
+            break;
+        default:
+            break;
+        }
+        break;
+
     case PL_FLOAT:
         switch (p.type()) {
         case QVariant::Double:
@@ -56,7 +56,7 @@ PREDICATE(window_title, 2) {
     if (ConsoleEdit* c = pqConsole::by_thread()) {
         QWidget *w = c->parentWidget();
         if (qobject_cast<QMainWindow*>(w)) {
-            PL_A1 = A(w->windowTitle());
+            PL_A1 = w2s(w->windowTitle());
             w->setWindowTitle(t2w(PL_A2));
             return TRUE;
         }
@@ -257,7 +257,7 @@ PREDICATE0(tty_clear) {
 PREDICATE(win_open_console, 5) {
     ConsoleEdit *ce = pqConsole::peek_first();
     if (!ce)
-        throw PlException(A("no ConsoleEdit available"));
+        throw PlException(FA("no ConsoleEdit available"));
 
     static IOFUNCTIONS rlc_functions = {
         Swipl_IO::_read_f,
@@ -339,7 +339,7 @@ PREDICATE(win_message_box, 2) {
                     min_width = int(Option[1]);
             }
             else
-                throw PlException(A(c->tr("option %1 : invalid arity").arg(t2w(Option))));
+                throw PlException(w2s(c->tr("option %1 : invalid arity").arg(t2w(Option))));
 
         int rc;
         QString err;
@@ -354,6 +354,7 @@ PREDICATE(win_message_box, 2) {
             if (!Image.isEmpty()) {
                 if (!imfile.load(Image)) {
                     err = c->tr("icon file %1 not found").arg(Image);
+                    s.go();
                     return;
                 }
                 if (scale)
@@ -378,7 +379,7 @@ PREDICATE(win_message_box, 2) {
         s.stop();
 
         if (!err.isEmpty())
-            throw PlException(A(err));
+            throw PlException(w2s(err));
 
         return rc;
     }
@@ -392,7 +393,7 @@ PREDICATE(win_preference_groups, 1) {
     Preferences p;
     PlTail l(PL_A1);
     foreach (auto g, p.childGroups())
-        l.append(A(g));
+        l.append(w2s(g));
     l.close();
     return TRUE;
 }
@@ -401,9 +402,10 @@ PREDICATE(win_preference_groups, 1) {
  */
 PREDICATE(win_preference_keys, 2) {
     Preferences p;
-    PlTail l(PL_A1);
+    p.beginGroup(t2w(PL_A1));
+    PlTail l(PL_A2);
     foreach (auto k, p.childKeys())
-        l.append(A(k));
+        l.append(w2s(k));
     l.close();
     return TRUE;
 }
@@ -419,7 +421,7 @@ PREDICATE(win_current_preference, 3) {
     p.beginGroup(g);
     if (p.contains(k)) {
         auto x = p.value(k).toString();
-        return PL_A3 = PlCompound(x.toStdWString().data());
+        return PL_A3 = PlCompound(WCS(x));
     }
 
     return FALSE;
@@ -445,7 +447,7 @@ PREDICATE(win_set_preference, 3) {
 PREDICATE(win_html_write, 1) {
     if (ConsoleEdit* c = pqConsole::by_thread()) {
         // run on foreground
-        if (PL_A1.type() == PL_ATOM) {
+        if (PL_A1.type() == PL_ATOM || PL_A1.type() == PL_STRING) {
             QString html = t2w(PL_A1);
             ConsoleEdit::exec_sync s;
             c->exec_func([&]() {